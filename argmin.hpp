@@ -0,0 +1,246 @@
+#pragma once
+
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <type_traits>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define DP_ARGMIN_X86 1
+#include <immintrin.h>
+#endif
+
+// Index of the first minimum of values[0, count), count > 0. The planner's
+// decision loop reduces to this over a contiguous slice of the previous
+// stage's costs, where infeasible states hold the largest cost and never win
+// a tie against a feasible one.
+template <typename Cost>
+using BasicArgminFunction = int (*)(const Cost *values, int count);
+using ArgminFunction = BasicArgminFunction<int>;
+
+enum class InstructionSet
+{
+  scalar,
+  sse41,
+  avx2,
+};
+
+inline const char *to_string(InstructionSet instruction_set)
+{
+  switch (instruction_set)
+  {
+  case InstructionSet::avx2:
+    return "avx2";
+  case InstructionSet::sse41:
+    return "sse4.1";
+  default:
+    return "scalar";
+  }
+}
+
+template <typename Cost>
+int argmin_scalar(const Cost *values, int count)
+{
+  int best = 0;
+  for (int i = 1; i < count; ++i)
+  {
+    if (values[i] < values[best])
+      best = i;
+  }
+  return best;
+}
+
+#ifdef DP_ARGMIN_X86
+
+// Each lane keeps the first minimum of its own subsequence (strict compare),
+// so the overall first minimum is the smallest index among the lanes holding
+// the minimum value.
+__attribute__((target("avx2"))) inline int argmin_avx2(const int *values, int count)
+{
+  constexpr int lanes = 8;
+  if (count < 2 * lanes)
+    return argmin_scalar(values, count);
+
+  __m256i best_values = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(values));
+  __m256i best_indices = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+  __m256i indices = best_indices;
+  const __m256i step = _mm256_set1_epi32(lanes);
+
+  int i = lanes;
+  for (; i + lanes <= count; i += lanes)
+  {
+    indices = _mm256_add_epi32(indices, step);
+    const __m256i candidates = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(values + i));
+    const __m256i improved = _mm256_cmpgt_epi32(best_values, candidates);
+    best_values = _mm256_min_epi32(best_values, candidates);
+    best_indices = _mm256_blendv_epi8(best_indices, indices, improved);
+  }
+
+  alignas(32) int lane_values[lanes];
+  alignas(32) int lane_indices[lanes];
+  _mm256_store_si256(reinterpret_cast<__m256i *>(lane_values), best_values);
+  _mm256_store_si256(reinterpret_cast<__m256i *>(lane_indices), best_indices);
+
+  int best = lane_indices[0];
+  for (int lane = 1; lane < lanes; ++lane)
+  {
+    if (lane_values[lane] < values[best] || (lane_values[lane] == values[best] && lane_indices[lane] < best))
+      best = lane_indices[lane];
+  }
+
+  for (; i < count; ++i)
+  {
+    if (values[i] < values[best])
+      best = i;
+  }
+  return best;
+}
+
+__attribute__((target("sse4.1"))) inline int argmin_sse41(const int *values, int count)
+{
+  constexpr int lanes = 4;
+  if (count < 2 * lanes)
+    return argmin_scalar(values, count);
+
+  __m128i best_values = _mm_loadu_si128(reinterpret_cast<const __m128i *>(values));
+  __m128i best_indices = _mm_setr_epi32(0, 1, 2, 3);
+  __m128i indices = best_indices;
+  const __m128i step = _mm_set1_epi32(lanes);
+
+  int i = lanes;
+  for (; i + lanes <= count; i += lanes)
+  {
+    indices = _mm_add_epi32(indices, step);
+    const __m128i candidates = _mm_loadu_si128(reinterpret_cast<const __m128i *>(values + i));
+    const __m128i improved = _mm_cmpgt_epi32(best_values, candidates);
+    best_values = _mm_min_epi32(best_values, candidates);
+    best_indices = _mm_blendv_epi8(best_indices, indices, improved);
+  }
+
+  alignas(16) int lane_values[lanes];
+  alignas(16) int lane_indices[lanes];
+  _mm_store_si128(reinterpret_cast<__m128i *>(lane_values), best_values);
+  _mm_store_si128(reinterpret_cast<__m128i *>(lane_indices), best_indices);
+
+  int best = lane_indices[0];
+  for (int lane = 1; lane < lanes; ++lane)
+  {
+    if (lane_values[lane] < values[best] || (lane_values[lane] == values[best] && lane_indices[lane] < best))
+      best = lane_indices[lane];
+  }
+
+  for (; i < count; ++i)
+  {
+    if (values[i] < values[best])
+      best = i;
+  }
+  return best;
+}
+
+// 16-bit costs fit twice as many lanes, too many to reduce lane by lane at
+// the end of the short slices the planner passes. Instead the minimum value
+// is found first, reduced across lanes with phminposuw (signed values are
+// flipped into unsigned order), and a second pass returns the first position
+// holding it.
+__attribute__((target("sse4.1"))) inline std::int16_t horizontal_min_sse41(__m128i values)
+{
+  const __m128i sign = _mm_set1_epi16(INT16_MIN);
+  return std::int16_t(_mm_cvtsi128_si32(_mm_minpos_epu16(_mm_xor_si128(values, sign))) ^ 0x8000);
+}
+
+__attribute__((target("avx2"))) inline int argmin_avx2(const std::int16_t *values, int count)
+{
+  constexpr int lanes = 16;
+  if (count < 2 * lanes)
+    return argmin_scalar(values, count);
+
+  __m256i minimums = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(values));
+  int i = lanes;
+  for (; i + lanes <= count; i += lanes)
+    minimums = _mm256_min_epi16(minimums, _mm256_loadu_si256(reinterpret_cast<const __m256i *>(values + i)));
+
+  std::int16_t minimum = horizontal_min_sse41(_mm_min_epi16(_mm256_castsi256_si128(minimums), _mm256_extracti128_si256(minimums, 1)));
+  for (int tail = i; tail < count; ++tail)
+    minimum = std::min(minimum, values[tail]);
+
+  const __m256i target = _mm256_set1_epi16(minimum);
+  for (i = 0; i + lanes <= count; i += lanes)
+  {
+    const __m256i candidates = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(values + i));
+    const unsigned mask = _mm256_movemask_epi8(_mm256_cmpeq_epi16(candidates, target));
+    if (mask != 0)
+      return i + __builtin_ctz(mask) / 2;
+  }
+  for (; values[i] != minimum; ++i)
+    ;
+  return i;
+}
+
+__attribute__((target("sse4.1"))) inline int argmin_sse41(const std::int16_t *values, int count)
+{
+  constexpr int lanes = 8;
+  if (count < 2 * lanes)
+    return argmin_scalar(values, count);
+
+  __m128i minimums = _mm_loadu_si128(reinterpret_cast<const __m128i *>(values));
+  int i = lanes;
+  for (; i + lanes <= count; i += lanes)
+    minimums = _mm_min_epi16(minimums, _mm_loadu_si128(reinterpret_cast<const __m128i *>(values + i)));
+
+  std::int16_t minimum = horizontal_min_sse41(minimums);
+  for (int tail = i; tail < count; ++tail)
+    minimum = std::min(minimum, values[tail]);
+
+  const __m128i target = _mm_set1_epi16(minimum);
+  for (i = 0; i + lanes <= count; i += lanes)
+  {
+    const __m128i candidates = _mm_loadu_si128(reinterpret_cast<const __m128i *>(values + i));
+    const unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi16(candidates, target));
+    if (mask != 0)
+      return i + __builtin_ctz(mask) / 2;
+  }
+  for (; values[i] != minimum; ++i)
+    ;
+  return i;
+}
+
+#endif
+
+inline InstructionSet detect_instruction_set()
+{
+#ifdef DP_ARGMIN_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    return InstructionSet::avx2;
+  if (__builtin_cpu_supports("sse4.1"))
+    return InstructionSet::sse41;
+#endif
+  return InstructionSet::scalar;
+}
+
+// Costs other than 32 and 16-bit integers use the scalar loop.
+template <typename Cost = int>
+BasicArgminFunction<Cost> select_argmin(InstructionSet instruction_set)
+{
+#ifdef DP_ARGMIN_X86
+  if constexpr (std::is_same_v<Cost, int> || std::is_same_v<Cost, std::int16_t>)
+  {
+    switch (instruction_set)
+    {
+    case InstructionSet::avx2:
+      return argmin_avx2;
+    case InstructionSet::sse41:
+      return argmin_sse41;
+    default:
+      break;
+    }
+  }
+#endif
+  return argmin_scalar<Cost>;
+}
+
+template <typename Cost = int>
+BasicArgminFunction<Cost> select_argmin()
+{
+  return select_argmin<Cost>(detect_instruction_set());
+}
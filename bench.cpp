@@ -0,0 +1,1425 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <new>
+#include <numeric>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <malloc.h>
+#include <sys/resource.h>
+
+#include "argmin.hpp"
+#include "cost.hpp"
+#include "dp_production_planner.hpp"
+#include "json.hpp"
+#include "perf_counters.hpp"
+#include "scenario_batch.hpp"
+#include "table.hpp"
+
+using json = nlohmann::json;
+
+// Heap allocations made so far, counted by the replaced global operator new,
+// which also reports them to the stage counters when they are compiled in.
+std::atomic<std::size_t> allocations_count{0};
+
+// The replacements are kept out of line: once inlined, the compiler sees a
+// pointer from operator new reach free and warns about a mismatched pair.
+__attribute__((noinline)) void *operator new(std::size_t size)
+{
+  ++allocations_count;
+  count_allocation(size);
+  if (void *pointer = std::malloc(size > 0 ? size : 1))
+    return pointer;
+  throw std::bad_alloc();
+}
+
+__attribute__((noinline)) void *operator new[](std::size_t size)
+{
+  return operator new(size);
+}
+
+__attribute__((noinline)) void operator delete(void *pointer) noexcept
+{
+  std::free(pointer);
+}
+
+__attribute__((noinline)) void operator delete[](void *pointer) noexcept
+{
+  operator delete(pointer);
+}
+
+__attribute__((noinline)) void operator delete(void *pointer, std::size_t) noexcept
+{
+  operator delete(pointer);
+}
+
+__attribute__((noinline)) void operator delete[](void *pointer, std::size_t) noexcept
+{
+  operator delete(pointer);
+}
+
+// Runs function until at least min_duration has passed and returns the mean
+// time of one call in nanoseconds.
+template <typename Function>
+double measure_ns(Function &&function)
+{
+  using clock = std::chrono::steady_clock;
+  constexpr auto min_duration = std::chrono::milliseconds(200);
+
+  function();
+  std::size_t calls = 0;
+  const auto start = clock::now();
+  auto elapsed = clock::duration::zero();
+  do
+  {
+    function();
+    ++calls;
+    elapsed = clock::now() - start;
+  } while (elapsed < min_duration);
+
+  return std::chrono::duration<double, std::nano>(elapsed).count() / calls;
+}
+
+// The plan a solve found, compared between solve paths that must agree.
+struct Plan
+{
+  bool found = false;
+  std::vector<int> decisions;
+  std::size_t total_cost = 0;
+
+  friend bool operator==(const Plan &left, const Plan &right)
+  {
+    return left.found == right.found &&
+           (!left.found || (left.decisions == right.decisions && left.total_cost == right.total_cost));
+  }
+
+  friend bool operator!=(const Plan &left, const Plan &right)
+  {
+    return !(left == right);
+  }
+};
+
+Plan solve_plan(DpProductionPlanner &planner, int production_capacity, int store_capacity, int store_cost,
+                int constant_cost, const std::vector<int> &requests, const DpProductionPlanner::Options &options)
+{
+  planner.reset(production_capacity, store_capacity, store_cost, constant_cost, 2, requests, options);
+  planner.calculate_stages();
+  Plan plan;
+  plan.found = planner.trace_plan();
+  plan.decisions = planner.decisions();
+  plan.total_cost = planner.total_cost();
+  return plan;
+}
+
+// The decision loop of one stage on a synthetic previous cost row: the
+// original branchy per-candidate loop against the argmin kernels used by the
+// simd kernel. Returns false when a kernel picks another decision than the
+// loop for some state.
+bool bench_decision_kernel()
+{
+  constexpr int store_capacity = 4095;
+  constexpr int constant_cost = 7;
+  constexpr int demand = 3;
+  constexpr int infeasible = INT_MAX;
+
+  std::mt19937 generator(42);
+  std::uniform_int_distribution<int> costs(0, 1000);
+  std::bernoulli_distribution infeasible_state(0.1);
+  std::vector<int> previous_costs(store_capacity + 1);
+  for (auto &cost : previous_costs)
+    cost = infeasible_state(generator) ? infeasible : costs(generator);
+
+  std::cout << "decision kernel (S = " << store_capacity << ", ns per candidate decision)" << std::endl;
+  std::cout << std::setw(8) << "P" << std::setw(12) << "loop";
+  const InstructionSet instruction_sets[] = {InstructionSet::scalar, InstructionSet::sse41, InstructionSet::avx2};
+  const InstructionSet detected = detect_instruction_set();
+  for (auto instruction_set : instruction_sets)
+  {
+    if (instruction_set <= detected)
+      std::cout << std::setw(12) << to_string(instruction_set);
+  }
+  std::cout << std::setw(12) << "speedup" << std::endl;
+
+  std::vector<int> loop_decisions(store_capacity + 1);
+  std::vector<int> kernel_decisions(store_capacity + 1);
+  bool same_decisions = true;
+  for (int production_capacity : {8, 32, 128, 512, 2048})
+  {
+    const double candidates = double(store_capacity + 1) * (production_capacity + 1);
+    const double loop_ns = measure_ns([&]
+                                      {
+      for (int state = 0; state <= store_capacity; ++state)
+      {
+        int optimal_cost = infeasible;
+        int optimal_decision = -1;
+        for (int x = 0; x <= production_capacity; ++x)
+        {
+          const int total_supply = state + x;
+          if (total_supply < demand)
+            continue;
+          const int to_store = total_supply - demand;
+          if (to_store > store_capacity)
+            continue;
+          if (previous_costs[to_store] == infeasible)
+            continue;
+          const int total_cost = (x > 0 ? constant_cost : 0) + previous_costs[to_store];
+          if (optimal_cost > total_cost)
+          {
+            optimal_cost = total_cost;
+            optimal_decision = x;
+          }
+        }
+        loop_decisions[state] = optimal_decision;
+      } });
+
+    std::cout << std::setw(8) << production_capacity << std::setw(12) << std::fixed << std::setprecision(3)
+              << loop_ns / candidates;
+
+    double best_ns = loop_ns;
+    for (auto instruction_set : instruction_sets)
+    {
+      if (instruction_set > detected)
+        continue;
+
+      const ArgminFunction argmin = select_argmin(instruction_set);
+      const double ns = measure_ns([&]
+                                   {
+        for (int state = 0; state <= store_capacity; ++state)
+        {
+          int optimal_cost = infeasible;
+          int optimal_decision = -1;
+          const int idle_to_store = state - demand;
+          if (idle_to_store >= 0 && previous_costs[idle_to_store] != infeasible)
+          {
+            optimal_cost = previous_costs[idle_to_store];
+            optimal_decision = 0;
+          }
+          const int first_x = std::max(1, -idle_to_store);
+          const int last_x = std::min(production_capacity, store_capacity - idle_to_store);
+          if (first_x <= last_x)
+          {
+            const int *candidates = previous_costs.data() + idle_to_store + first_x;
+            const int best = argmin(candidates, last_x - first_x + 1);
+            if (candidates[best] != infeasible && optimal_cost > constant_cost + candidates[best])
+              optimal_decision = first_x + best;
+          }
+          kernel_decisions[state] = optimal_decision;
+        } });
+
+      if (kernel_decisions != loop_decisions)
+      {
+        std::cout << " (" << to_string(instruction_set) << " decisions differ!)";
+        same_decisions = false;
+      }
+      std::cout << std::setw(12) << ns / candidates;
+      best_ns = std::min(best_ns, ns);
+    }
+    std::cout << std::setw(11) << loop_ns / best_ns << "x" << std::endl;
+  }
+
+  if (!same_decisions)
+    std::cout << "FAILED: argmin kernels picked other decisions than the loop" << std::endl;
+  return same_decisions;
+}
+
+// A stage-sized table written to /dev/null: building a table of strings and
+// drawing it with print_table, which flushes on every line, against
+// TableRenderer formatting the same cells straight into its buffer.
+void bench_table_rendering()
+{
+  std::ofstream null_stream("/dev/null");
+  std::streambuf *const cout_buffer = std::cout.rdbuf();
+
+  std::mt19937 generator(42);
+  std::uniform_int_distribution<int> costs(0, 100000);
+  std::bernoulli_distribution infeasible_decision(0.3);
+
+  std::cout << "table rendering (ns per cell)" << std::endl;
+  std::cout << std::setw(8) << "rows" << std::setw(8) << "columns" << std::setw(14) << "print_table"
+            << std::setw(14) << "renderer" << std::setw(12) << "speedup" << std::endl;
+
+  for (auto [rows_count, columns_count] : {std::pair<int, int>{16, 8}, {256, 32}, {2048, 128}})
+  {
+    std::vector<int> values(std::size_t(rows_count) * columns_count);
+    for (auto &value : values)
+      value = infeasible_decision(generator) ? -1 : costs(generator);
+
+    std::cout.rdbuf(null_stream.rdbuf());
+    const double print_table_ns = measure_ns([&]
+                                             {
+      std::vector<std::vector<std::string>> table;
+      for (int row = 0; row < rows_count; ++row)
+      {
+        std::vector<std::string> cells;
+        for (int column = 0; column < columns_count; ++column)
+        {
+          const int value = values[std::size_t(row) * columns_count + column];
+          cells.push_back(value < 0 ? "-" : std::to_string(value));
+        }
+        table.push_back(cells);
+      }
+      print_table(table); });
+
+    TableRenderer renderer;
+    const double renderer_ns = measure_ns([&]
+                                          { renderer.render(null_stream, rows_count, columns_count,
+                                                            [&](std::size_t row, std::size_t column, TableRenderer::CellBuffer &scratch) -> std::string_view
+                                                            {
+                                                              const int value = values[row * columns_count + column];
+                                                              if (value < 0)
+                                                                return "-";
+                                                              return TableRenderer::format(value, scratch);
+                                                            }); });
+    std::cout.rdbuf(cout_buffer);
+
+    const double cells = double(rows_count) * columns_count;
+    std::cout << std::setw(8) << rows_count << std::setw(8) << columns_count << std::setw(14) << std::fixed
+              << std::setprecision(2) << print_table_ns / cells << std::setw(14) << renderer_ns / cells << std::setw(11)
+              << print_table_ns / renderer_ns << "x" << std::endl;
+  }
+}
+
+// Latency of changing one period's demand: solving the instance again from
+// scratch against update_request, which only recomputes the stages from the
+// changed period's down. Early periods are the last stages and the cheapest
+// to update; the last period is the first stage, so its edits redo the whole
+// table. The checkpoint engine's trace recomputes its segments either way.
+// Returns false when an updated plan differs from a full solve of the edited
+// requests.
+bool bench_request_update()
+{
+  constexpr int periods_count = 2000;
+  constexpr int production_capacity = 24;
+  constexpr int store_capacity = 64;
+
+  std::mt19937 generator(42);
+  std::uniform_int_distribution<int> demands(0, 20);
+  std::vector<int> requests(periods_count);
+  for (auto &request : requests)
+    request = demands(generator);
+
+  std::cout << "request update (N = " << periods_count << ", S = " << store_capacity << ", P = " << production_capacity
+            << ", us per edit)" << std::endl;
+  std::cout << std::setw(12) << "engine" << std::setw(8) << "period" << std::setw(12) << "full" << std::setw(12)
+            << "update" << std::setw(12) << "speedup" << std::endl;
+
+  const std::pair<const char *, DpProductionPlanner::Engine> engines[] = {
+      {"table", DpProductionPlanner::Engine::table},
+      {"checkpoint", DpProductionPlanner::Engine::checkpoint},
+  };
+  bool same_plans = true;
+  for (auto [name, engine] : engines)
+  {
+    DpProductionPlanner::Options options;
+    options.engine = engine;
+    options.output = DpProductionPlanner::Output::none;
+
+    for (int period : {0, periods_count / 2, periods_count - 1})
+    {
+      const int request = requests[period];
+      int edit = 0;
+      DpProductionPlanner planner;
+      const double full_ns = measure_ns([&]
+                                        {
+        requests[period] = request + (++edit & 1);
+        planner.reset(production_capacity, store_capacity, 1, 50, 2, requests, options);
+        planner.calculate_stages();
+        planner.trace_plan(); });
+      const double update_ns = measure_ns([&]
+                                          { planner.update_request(period, request + (++edit & 1)); });
+
+      requests[period] = request + (edit & 1);
+      DpProductionPlanner full_planner(production_capacity, store_capacity, 1, 50, 2, requests, options);
+      full_planner.calculate_stages();
+      const bool found = full_planner.trace_plan();
+      const bool same_plan = found == planner.trace_plan() &&
+                             (!found || (planner.decisions() == full_planner.decisions() &&
+                                         planner.total_cost() == full_planner.total_cost()));
+      same_plans = same_plans && same_plan;
+      requests[period] = request;
+
+      std::cout << std::setw(12) << name << std::setw(8) << period << std::setw(12) << std::fixed
+                << std::setprecision(1) << full_ns / 1000 << std::setw(12) << update_ns / 1000 << std::setw(11)
+                << full_ns / update_ns << "x";
+      if (!same_plan)
+        std::cout << " (plans differ!)";
+      std::cout << std::endl;
+    }
+  }
+
+  if (!same_plans)
+    std::cout << "FAILED: updated plans differ from full solves" << std::endl;
+  return same_plans;
+}
+
+// Extending a horizon of N periods by one: a full solve of the longer
+// instance with the table engine against append_request on the forward
+// engine, which must reach the same total cost. Returns false when it does
+// not.
+bool bench_request_append()
+{
+  constexpr int production_capacity = 24;
+  constexpr int store_capacity = 64;
+
+  std::cout << "request append (S = " << store_capacity << ", P = " << production_capacity << ", us per period)"
+            << std::endl;
+  std::cout << std::setw(8) << "N" << std::setw(12) << "full" << std::setw(12) << "append" << std::setw(12)
+            << "speedup" << std::endl;
+
+  bool same_costs = true;
+  for (int periods_count : {100, 1000, 10000})
+  {
+    std::mt19937 generator(42);
+    std::uniform_int_distribution<int> demands(0, 20);
+    std::vector<int> requests(periods_count + 1);
+    for (auto &request : requests)
+      request = demands(generator);
+
+    DpProductionPlanner::Options options;
+    options.output = DpProductionPlanner::Output::none;
+    DpProductionPlanner full_planner;
+    const double full_ns = measure_ns([&]
+                                      {
+      full_planner.reset(production_capacity, store_capacity, 1, 50, 2, requests, options);
+      full_planner.calculate_stages();
+      full_planner.trace_plan(); });
+
+    options.engine = DpProductionPlanner::Engine::forward;
+    const std::vector<int> horizon(requests.begin(), requests.end() - 1);
+    DpProductionPlanner forward_planner(production_capacity, store_capacity, 1, 50, 2, horizon, options);
+    forward_planner.calculate_stages();
+    forward_planner.append_request(requests.back());
+    forward_planner.trace_plan();
+    const std::size_t append_cost = forward_planner.total_cost();
+
+    // The horizon keeps growing while timing; every append costs the same.
+    const double append_ns = measure_ns([&]
+                                        { forward_planner.append_request(demands(generator)); });
+
+    std::cout << std::setw(8) << periods_count << std::setw(12) << std::fixed << std::setprecision(1)
+              << full_ns / 1000 << std::setw(12) << append_ns / 1000 << std::setw(11) << full_ns / append_ns << "x";
+    if (append_cost != full_planner.total_cost())
+    {
+      std::cout << " (total costs differ!)";
+      same_costs = false;
+    }
+    std::cout << std::endl;
+  }
+
+  if (!same_costs)
+    std::cout << "FAILED: appended horizons cost another total than full solves" << std::endl;
+  return same_costs;
+}
+
+// A batch of scenarios sharing every dimension: one planner per scenario
+// against ScenarioBatchPlanner solving eight of them per vector instruction.
+// The batch kernel does the simd kernel's O(S * P) work per stage (P widened
+// by the spread of the lanes' demands), while the sliding window kernel is
+// O(S) and pulls ahead as P grows. Returns false when the batch finds
+// another plan than the planner for some scenario.
+bool bench_scenario_batch()
+{
+  constexpr int scenarios_count = 64;
+  constexpr int periods_count = 365;
+
+  std::cout << "scenario batch (" << scenarios_count << " scenarios, N = " << periods_count
+            << ", us per scenario)" << std::endl;
+  std::cout << std::setw(8) << "S" << std::setw(8) << "P" << std::setw(12) << "simd" << std::setw(16)
+            << "sliding_window" << std::setw(12) << "batch" << std::setw(12) << "vs simd" << std::endl;
+
+  bool all_same_plans = true;
+  for (auto [store_capacity, production_capacity] : {std::pair<int, int>{16, 8}, {64, 24}, {256, 64}})
+  {
+    std::mt19937 generator(42);
+    std::uniform_int_distribution<int> demands(0, production_capacity * 3 / 4);
+    std::vector<std::vector<int>> scenarios(scenarios_count, std::vector<int>(periods_count));
+    for (auto &scenario : scenarios)
+    {
+      for (auto &request : scenario)
+        request = demands(generator);
+    }
+
+    DpProductionPlanner::Options options;
+    options.engine = DpProductionPlanner::Engine::rolling;
+    options.output = DpProductionPlanner::Output::none;
+    DpProductionPlanner planner;
+    auto solve_each = [&]
+    {
+      for (const auto &scenario : scenarios)
+      {
+        planner.reset(production_capacity, store_capacity, 1, 50, 2, scenario, options);
+        planner.calculate_stages();
+        planner.trace_plan();
+      }
+    };
+    options.kernel = DpProductionPlanner::Kernel::simd;
+    const double simd_ns = measure_ns(solve_each);
+    options.kernel = DpProductionPlanner::Kernel::sliding_window;
+    const double window_ns = measure_ns(solve_each);
+
+    ScenarioBatchPlanner batch;
+    const double batch_ns = measure_ns([&]
+                                       {
+      batch.reset(production_capacity, store_capacity, 1, 50, 2, scenarios);
+      batch.calculate_stages(); });
+
+    bool same_plans = true;
+    for (std::size_t scenario = 0; scenario < scenarios.size(); ++scenario)
+    {
+      planner.reset(production_capacity, store_capacity, 1, 50, 2, scenarios[scenario], options);
+      planner.calculate_stages();
+      const bool found = planner.trace_plan();
+      same_plans = same_plans && found == batch.found(scenario) &&
+                   (!found || (planner.decisions() == batch.decisions(scenario) && planner.total_cost() == batch.total_cost(scenario)));
+    }
+
+    std::cout << std::setw(8) << store_capacity << std::setw(8) << production_capacity << std::setw(12) << std::fixed
+              << std::setprecision(1) << simd_ns / scenarios_count / 1000 << std::setw(16)
+              << window_ns / scenarios_count / 1000 << std::setw(12) << batch_ns / scenarios_count / 1000
+              << std::setw(11) << simd_ns / batch_ns << "x";
+    if (!same_plans)
+      std::cout << " (plans differ!)";
+    std::cout << std::endl;
+    all_same_plans = all_same_plans && same_plans;
+  }
+
+  if (!all_same_plans)
+    std::cout << "FAILED: batched plans differ from single solves" << std::endl;
+  return all_same_plans;
+}
+
+// Random instances solved by every backward engine and kernel with and
+// without state pruning, against the unpruned table engine with the scalar
+// kernel; all of them break ties towards the smallest production, so the
+// plans must be identical. Returns false when they are not.
+bool bench_engines()
+{
+  constexpr int instances_count = 30;
+
+  const std::pair<const char *, DpProductionPlanner::Engine> engines[] = {
+      {"table", DpProductionPlanner::Engine::table},
+      {"rolling", DpProductionPlanner::Engine::rolling},
+      {"checkpoint", DpProductionPlanner::Engine::checkpoint},
+  };
+  const std::pair<const char *, DpProductionPlanner::Kernel> kernels[] = {
+      {"scalar", DpProductionPlanner::Kernel::scalar},
+      {"sliding_window", DpProductionPlanner::Kernel::sliding_window},
+      {"simd", DpProductionPlanner::Kernel::simd},
+  };
+
+  std::vector<std::pair<int, int>> capacities(instances_count);
+  std::vector<std::pair<int, int>> costs(instances_count);
+  std::vector<std::vector<int>> instances(instances_count);
+  std::vector<Plan> reference_plans(instances_count);
+  std::mt19937 generator(42);
+  DpProductionPlanner::Options options;
+  options.output = DpProductionPlanner::Output::none;
+  options.lot_sizing = false;
+  options.specialize_small_capacities = false;
+  options.prune_states = false;
+  DpProductionPlanner planner;
+  for (int instance = 0; instance < instances_count; ++instance)
+  {
+    const int production_capacity = std::uniform_int_distribution<int>(1, 60)(generator);
+    const int store_capacity = std::uniform_int_distribution<int>(0, 300)(generator);
+    capacities[instance] = {production_capacity, store_capacity};
+    costs[instance] = {std::uniform_int_distribution<int>(0, 4)(generator),
+                       std::uniform_int_distribution<int>(0, 200)(generator)};
+    // Some demands exceed the production capacity, so plans have to store
+    // ahead and some instances are infeasible.
+    std::uniform_int_distribution<int> demands(0, production_capacity + production_capacity / 4);
+    instances[instance].resize(std::uniform_int_distribution<int>(1, 100)(generator));
+    for (auto &request : instances[instance])
+      request = demands(generator);
+    reference_plans[instance] = solve_plan(planner, production_capacity, store_capacity, costs[instance].first,
+                                           costs[instance].second, instances[instance], options);
+  }
+
+  std::cout << "engines (" << instances_count << " instances, S <= 300, P <= 60, N <= 100, against unpruned "
+            << "table + scalar)" << std::endl;
+  std::cout << std::setw(12) << "engine" << std::setw(16) << "kernel" << std::setw(8) << "pruned" << std::setw(12)
+            << "differ" << std::endl;
+
+  bool same_plans = true;
+  for (auto [engine_name, engine] : engines)
+  {
+    for (auto [kernel_name, kernel] : kernels)
+    {
+      for (bool prune_states : {false, true})
+      {
+        options.engine = engine;
+        options.kernel = kernel;
+        options.prune_states = prune_states;
+        int differing_count = 0;
+        for (int instance = 0; instance < instances_count; ++instance)
+        {
+          const Plan plan = solve_plan(planner, capacities[instance].first, capacities[instance].second,
+                                       costs[instance].first, costs[instance].second, instances[instance], options);
+          if (plan != reference_plans[instance])
+            ++differing_count;
+        }
+
+        std::cout << std::setw(12) << engine_name << std::setw(16) << kernel_name << std::setw(8)
+                  << (prune_states ? "yes" : "no") << std::setw(12) << differing_count << std::endl;
+        same_plans = same_plans && differing_count == 0;
+      }
+    }
+  }
+
+  if (!same_plans)
+    std::cout << "FAILED: engine plans differ from the unpruned table engine" << std::endl;
+  return same_plans;
+}
+
+// Random instances large enough for the states of a stage to be split
+// between workers, solved with one thread and with four by every engine and
+// kernel. The chunks compute the same minima, so the plans must be
+// identical. Returns false when they are not.
+bool bench_threads()
+{
+  constexpr int instances_count = 12;
+  constexpr int periods_count = 100;
+  constexpr int threads_count = 4;
+
+  const std::pair<const char *, DpProductionPlanner::Engine> engines[] = {
+      {"table", DpProductionPlanner::Engine::table},
+      {"rolling", DpProductionPlanner::Engine::rolling},
+      {"checkpoint", DpProductionPlanner::Engine::checkpoint},
+      {"forward", DpProductionPlanner::Engine::forward},
+  };
+  const std::pair<const char *, DpProductionPlanner::Kernel> kernels[] = {
+      {"scalar", DpProductionPlanner::Kernel::scalar},
+      {"sliding_window", DpProductionPlanner::Kernel::sliding_window},
+      {"simd", DpProductionPlanner::Kernel::simd},
+  };
+
+  std::cout << "threads (" << instances_count << " instances, N = " << periods_count << ", S <= 1000, 1 against "
+            << threads_count << " threads)" << std::endl;
+  std::cout << std::setw(12) << "engine" << std::setw(16) << "kernel" << std::setw(12) << "differ" << std::endl;
+
+  std::mt19937 generator(42);
+  bool same_plans = true;
+  for (auto [engine_name, engine] : engines)
+  {
+    for (auto [kernel_name, kernel] : kernels)
+    {
+      int differing_count = 0;
+      for (int instance = 0; instance < instances_count; ++instance)
+      {
+        const int store_capacity = std::uniform_int_distribution<int>(600, 1000)(generator);
+        const int production_capacity = std::uniform_int_distribution<int>(8, 64)(generator);
+        std::uniform_int_distribution<int> demands(0, production_capacity);
+        std::vector<int> requests(periods_count);
+        for (auto &request : requests)
+          request = demands(generator);
+
+        DpProductionPlanner::Options options;
+        options.engine = engine;
+        options.kernel = kernel;
+        options.output = DpProductionPlanner::Output::none;
+        options.lot_sizing = false;
+        DpProductionPlanner planner;
+        options.threads = 1;
+        const Plan sequential = solve_plan(planner, production_capacity, store_capacity, 1, 50, requests, options);
+        options.threads = threads_count;
+        const Plan threaded = solve_plan(planner, production_capacity, store_capacity, 1, 50, requests, options);
+        if (threaded != sequential)
+          ++differing_count;
+      }
+
+      std::cout << std::setw(12) << engine_name << std::setw(16) << kernel_name << std::setw(12) << differing_count
+                << std::endl;
+      same_plans = same_plans && differing_count == 0;
+    }
+  }
+
+  if (!same_plans)
+    std::cout << "FAILED: threaded plans differ from single-threaded solves" << std::endl;
+  return same_plans;
+}
+
+// Random instances with regeneration points, periods whose demand can only
+// be met with a full store and full production, solved by the engines that
+// split the horizon there with split_segments on and off. Shifting a segment
+// by the cost before it does not change its decisions, so the plans must be
+// identical. Returns false when they are not.
+bool bench_segments()
+{
+  constexpr int instances_count = 50;
+  constexpr int periods_count = 400;
+  constexpr int regeneration_interval = 8;
+
+  const std::pair<const char *, DpProductionPlanner::Engine> engines[] = {
+      {"table", DpProductionPlanner::Engine::table},
+      {"forward", DpProductionPlanner::Engine::forward},
+  };
+
+  std::cout << "segments (" << instances_count << " instances, N = " << periods_count
+            << ", a regeneration point every " << regeneration_interval << " periods, 4 threads)" << std::endl;
+  std::cout << std::setw(12) << "engine" << std::setw(12) << "sequential" << std::setw(12) << "segments"
+            << std::setw(12) << "differ" << std::endl;
+
+  bool same_plans = true;
+  for (auto [name, engine] : engines)
+  {
+    std::mt19937 generator(42);
+    double sequential_ns = 0;
+    double segments_ns = 0;
+    int differing_count = 0;
+    for (int instance = 0; instance < instances_count; ++instance)
+    {
+      const int production_capacity = std::uniform_int_distribution<int>(8, 32)(generator);
+      const int store_capacity = std::uniform_int_distribution<int>(production_capacity / 2, 2 * production_capacity)(generator);
+      std::uniform_int_distribution<int> demands(0, production_capacity / 2);
+      std::vector<int> requests(periods_count);
+      for (int period = 0; period < periods_count; ++period)
+        requests[period] = period % regeneration_interval == regeneration_interval - 1 ? production_capacity + store_capacity
+                                                                                       : demands(generator);
+
+      DpProductionPlanner::Options options;
+      options.engine = engine;
+      options.output = DpProductionPlanner::Output::none;
+      options.threads = 4;
+      DpProductionPlanner planner;
+      auto solve = [&]
+      {
+        const auto start = std::chrono::steady_clock::now();
+        const Plan plan = solve_plan(planner, production_capacity, store_capacity, 1, 50, requests, options);
+        return std::make_pair(plan, std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count());
+      };
+
+      options.split_segments = false;
+      const auto [sequential, sequential_instance_ns] = solve();
+      options.split_segments = true;
+      const auto [segments, segments_instance_ns] = solve();
+      sequential_ns += sequential_instance_ns;
+      segments_ns += segments_instance_ns;
+      if (!sequential.found || segments != sequential)
+        ++differing_count;
+    }
+
+    std::cout << std::setw(12) << name << std::setw(12) << std::fixed << std::setprecision(1)
+              << sequential_ns / instances_count / 1000 << std::setw(12) << segments_ns / instances_count / 1000
+              << std::setw(12) << differing_count << std::endl;
+    same_plans = same_plans && differing_count == 0;
+  }
+
+  if (!same_plans)
+    std::cout << "FAILED: segment-parallel plans differ from sequential solves" << std::endl;
+  return same_plans;
+}
+
+// Random instances solved by the min_plus engine against the table engine,
+// which must find the same plans: stores small enough for eight threads to
+// take the transform product path, and larger ones where it falls back to
+// solving stage by stage. Returns false when the plans differ.
+bool bench_min_plus()
+{
+  constexpr int instances_count = 200;
+  constexpr int threads_count = 8;
+
+  std::cout << "min_plus (" << instances_count << " instances per store range, " << threads_count
+            << " threads, against the table engine)" << std::endl;
+  std::cout << std::setw(12) << "S" << std::setw(12) << "differ" << std::endl;
+
+  std::mt19937 generator(42);
+  bool same_plans = true;
+  for (auto [min_store_capacity, max_store_capacity] : {std::pair<int, int>{0, 3}, {16, 64}})
+  {
+    int differing_count = 0;
+    for (int instance = 0; instance < instances_count; ++instance)
+    {
+      const int store_capacity = std::uniform_int_distribution<int>(min_store_capacity, max_store_capacity)(generator);
+      const int production_capacity = std::uniform_int_distribution<int>(1, 6)(generator);
+      std::uniform_int_distribution<int> demands(0, production_capacity);
+      std::vector<int> requests(std::uniform_int_distribution<int>(1, 400)(generator));
+      for (auto &request : requests)
+        request = demands(generator);
+      const int store_cost = std::uniform_int_distribution<int>(0, 3)(generator);
+      const int constant_cost = std::uniform_int_distribution<int>(0, 40)(generator);
+
+      DpProductionPlanner::Options options;
+      options.output = DpProductionPlanner::Output::none;
+      options.lot_sizing = false;
+      options.specialize_small_capacities = false;
+      DpProductionPlanner planner;
+      const Plan table = solve_plan(planner, production_capacity, store_capacity, store_cost, constant_cost, requests, options);
+      options.engine = DpProductionPlanner::Engine::min_plus;
+      options.threads = threads_count;
+      const Plan min_plus = solve_plan(planner, production_capacity, store_capacity, store_cost, constant_cost, requests, options);
+      if (min_plus != table)
+        ++differing_count;
+    }
+
+    std::cout << std::setw(5) << min_store_capacity << " - " << std::setw(4) << max_store_capacity << std::setw(12)
+              << differing_count << std::endl;
+    same_plans = same_plans && differing_count == 0;
+  }
+
+  if (!same_plans)
+    std::cout << "FAILED: min_plus plans differ from the table engine" << std::endl;
+  return same_plans;
+}
+
+// Random uncapacitated instances, including ones whose zero setup or holding
+// cost makes many plans optimal, solved by Wagner-Whitin lot sizing against
+// the stage DP, which must find the same plans (ties to the smallest
+// production). Returns false when they do not.
+bool bench_lot_sizing()
+{
+  constexpr int instances_count = 500;
+  constexpr int max_periods_count = 60;
+
+  std::mt19937 generator(42);
+  std::uniform_int_distribution<int> periods(1, max_periods_count);
+  std::uniform_int_distribution<int> demands(0, 8);
+  std::uniform_int_distribution<int> holdings(0, 5);
+  std::uniform_int_distribution<int> setups(0, 100);
+
+  DpProductionPlanner::Options options;
+  options.output = DpProductionPlanner::Output::none;
+  options.specialize_small_capacities = false;
+  DpProductionPlanner planner;
+  double stages_ns = 0;
+  double lot_sizing_ns = 0;
+  int differing_count = 0;
+  for (int instance = 0; instance < instances_count; ++instance)
+  {
+    std::vector<int> requests(periods(generator));
+    for (auto &request : requests)
+      request = instance % 3 == 0 && demands(generator) < 6 ? 0 : demands(generator);
+    const int total_demand = std::accumulate(requests.begin(), requests.end(), 0);
+    const int holding = holdings(generator);
+    const int setup = setups(generator);
+    // One timed solve each; measure_ns would repeat every instance for far
+    // longer than it takes.
+    auto solve = [&]
+    {
+      const auto start = std::chrono::steady_clock::now();
+      planner.reset(total_demand, total_demand, holding, setup, 2, requests, options);
+      planner.calculate_stages();
+      planner.trace_plan();
+      return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    };
+
+    options.lot_sizing = false;
+    stages_ns += solve();
+    const std::vector<int> stage_decisions = planner.decisions();
+    const std::size_t stage_cost = planner.total_cost();
+    options.lot_sizing = true;
+    lot_sizing_ns += solve();
+    if (planner.decisions() != stage_decisions || planner.total_cost() != stage_cost)
+      ++differing_count;
+  }
+
+  std::cout << "lot sizing (" << instances_count << " uncapacitated instances, N <= " << max_periods_count
+            << ", us per solve)" << std::endl;
+  std::cout << std::setw(12) << "stages" << std::setw(12) << "lot sizing" << std::setw(12) << "differ" << std::endl;
+  std::cout << std::setw(12) << std::fixed << std::setprecision(2) << stages_ns / instances_count / 1000
+            << std::setw(12) << lot_sizing_ns / instances_count / 1000 << std::setw(12) << differing_count << std::endl;
+
+  if (differing_count > 0)
+    std::cout << "FAILED: lot sizing plans differ from the stage DP" << std::endl;
+  return differing_count == 0;
+}
+
+// A horizon of small capacities solved by the specialized solver against the
+// general rolling engine with the scalar and sliding window kernels, which
+// must find the same plans. Returns false when they do not.
+bool bench_small_capacities()
+{
+  constexpr int periods_count = 365;
+
+  std::cout << "small capacities (N = " << periods_count << ", us per solve)" << std::endl;
+  std::cout << std::setw(8) << "S" << std::setw(8) << "P" << std::setw(12) << "scalar" << std::setw(16)
+            << "sliding_window" << std::setw(12) << "specialized" << std::setw(12) << "vs scalar" << std::endl;
+
+  bool same_plans = true;
+  for (auto [store_capacity, production_capacity] : {std::pair<int, int>{2, 2}, {4, 4}, {8, 4}, {8, 8}})
+  {
+    std::mt19937 generator(42);
+    std::uniform_int_distribution<int> demands(0, production_capacity * 3 / 4);
+    std::vector<int> requests(periods_count);
+    for (auto &request : requests)
+      request = demands(generator);
+
+    DpProductionPlanner::Options options;
+    options.engine = DpProductionPlanner::Engine::rolling;
+    options.output = DpProductionPlanner::Output::none;
+    DpProductionPlanner planner;
+    auto solve = [&]
+    {
+      planner.reset(production_capacity, store_capacity, 1, 50, 2, requests, options);
+      planner.calculate_stages();
+      planner.trace_plan();
+    };
+
+    options.specialize_small_capacities = false;
+    options.kernel = DpProductionPlanner::Kernel::scalar;
+    const double scalar_ns = measure_ns(solve);
+    const std::vector<int> scalar_decisions = planner.decisions();
+    const std::size_t scalar_cost = planner.total_cost();
+    options.kernel = DpProductionPlanner::Kernel::sliding_window;
+    const double window_ns = measure_ns(solve);
+    const bool window_same = planner.decisions() == scalar_decisions && planner.total_cost() == scalar_cost;
+    options.specialize_small_capacities = true;
+    const double specialized_ns = measure_ns(solve);
+    const bool same_plan = window_same && planner.decisions() == scalar_decisions && planner.total_cost() == scalar_cost;
+
+    std::cout << std::setw(8) << store_capacity << std::setw(8) << production_capacity << std::setw(12) << std::fixed
+              << std::setprecision(2) << scalar_ns / 1000 << std::setw(16) << window_ns / 1000 << std::setw(12)
+              << specialized_ns / 1000 << std::setw(11) << scalar_ns / specialized_ns << "x";
+    if (!same_plan)
+      std::cout << " (plans differ!)";
+    std::cout << std::endl;
+    same_plans = same_plans && same_plan;
+  }
+
+  if (!same_plans)
+    std::cout << "FAILED: small capacity plans differ from the general engine" << std::endl;
+  return same_plans;
+}
+
+// One instance solved with every cost type; its costs are small enough for
+// int16, so all of them must find the same plan.
+template <typename Cost>
+double measure_cost_type(const std::vector<int> &requests, int production_capacity, int store_capacity,
+                         DpProductionPlanner::Kernel kernel, std::vector<int> &decisions, std::size_t &total_cost)
+{
+  DpProductionPlanner::Options options;
+  options.engine = DpProductionPlanner::Engine::rolling;
+  options.kernel = kernel;
+  options.output = DpProductionPlanner::Output::none;
+  BasicDpProductionPlanner<Cost> planner;
+  const double ns = measure_ns([&]
+                               {
+    planner.reset(production_capacity, store_capacity, 1, 20, 2, requests, options);
+    planner.calculate_stages();
+    planner.trace_plan(); });
+  decisions = planner.decisions();
+  total_cost = planner.total_cost();
+  return ns;
+}
+
+// Returns false when some cost type finds another plan than the others.
+bool bench_cost_types()
+{
+  constexpr int periods_count = 200;
+  constexpr int production_capacity = 64;
+  constexpr int store_capacity = 128;
+
+  std::mt19937 generator(42);
+  std::uniform_int_distribution<int> demands(0, production_capacity * 3 / 4);
+  std::vector<int> requests(periods_count);
+  for (auto &request : requests)
+    request = demands(generator);
+
+  std::cout << "cost types (N = " << periods_count << ", S = " << store_capacity << ", P = " << production_capacity
+            << ", auto picks " << to_string(select_cost_type(periods_count, store_capacity, 1, 20))
+            << ", us per solve)" << std::endl;
+  std::cout << std::setw(16) << "kernel" << std::setw(12) << "int16" << std::setw(12) << "int32" << std::setw(12)
+            << "int64" << std::setw(12) << "checked" << std::endl;
+
+  const std::pair<const char *, DpProductionPlanner::Kernel> kernels[] = {
+      {"scalar", DpProductionPlanner::Kernel::scalar},
+      {"sliding_window", DpProductionPlanner::Kernel::sliding_window},
+      {"simd", DpProductionPlanner::Kernel::simd},
+  };
+  bool same_plans = true;
+  for (auto [name, kernel] : kernels)
+  {
+    std::vector<int> decisions[4];
+    std::size_t total_costs[4];
+    const double int16_ns = measure_cost_type<std::int16_t>(requests, production_capacity, store_capacity, kernel,
+                                                            decisions[0], total_costs[0]);
+    const double int32_ns = measure_cost_type<std::int32_t>(requests, production_capacity, store_capacity, kernel,
+                                                            decisions[1], total_costs[1]);
+    const double int64_ns = measure_cost_type<std::int64_t>(requests, production_capacity, store_capacity, kernel,
+                                                            decisions[2], total_costs[2]);
+    const double checked_ns = measure_cost_type<CheckedCost>(requests, production_capacity, store_capacity, kernel,
+                                                             decisions[3], total_costs[3]);
+    bool same_plan = true;
+    for (int type = 1; type < 4; ++type)
+      same_plan = same_plan && decisions[type] == decisions[0] && total_costs[type] == total_costs[0];
+
+    std::cout << std::setw(16) << name << std::setw(12) << std::fixed << std::setprecision(1) << int16_ns / 1000
+              << std::setw(12) << int32_ns / 1000 << std::setw(12) << int64_ns / 1000 << std::setw(12)
+              << checked_ns / 1000;
+    if (!same_plan)
+      std::cout << " (plans differ!)";
+    std::cout << std::endl;
+    same_plans = same_plans && same_plan;
+  }
+
+  if (!same_plans)
+    std::cout << "FAILED: cost types found different plans" << std::endl;
+
+  // An explicit cost type too narrow for the instance must be refused rather
+  // than wrap around.
+  bool refused = false;
+  try
+  {
+    BasicDpProductionPlanner<std::int16_t> planner(production_capacity, store_capacity, 30000, 20, 1, requests);
+  }
+  catch (const std::overflow_error &)
+  {
+    refused = true;
+  }
+  if (!refused)
+    std::cout << "FAILED: int16 accepted costs beyond its range" << std::endl;
+
+  // Uncapacitated instances whose holding costs would overflow lot sizing's
+  // 64-bit sums: checked costs must find the optimum, producing each demand
+  // in its own period, or report the overflow, never another plan.
+  bool checked_correct = true;
+  const std::pair<std::size_t, std::size_t> huge_holdings[] = {{3481248731582150605ULL, 9999}, {1000000000000000ULL, 3}};
+  for (auto [holding, last_period] : huge_holdings)
+  {
+    std::vector<int> sparse_requests(last_period + 1, 0);
+    sparse_requests.front() = 1;
+    sparse_requests.back() = 1;
+    DpProductionPlanner::Options options;
+    options.output = DpProductionPlanner::Output::none;
+    options.specialize_small_capacities = false;
+    try
+    {
+      BasicDpProductionPlanner<CheckedCost> planner(2, 1, holding, 1000, 0, sparse_requests, options);
+      planner.calculate_stages();
+      checked_correct = checked_correct && planner.trace_plan() && planner.total_cost() == 2000 &&
+                        planner.decisions() == sparse_requests;
+    }
+    catch (const std::overflow_error &)
+    {
+    }
+  }
+  if (!checked_correct)
+    std::cout << "FAILED: checked costs found a wrong plan for huge holding costs" << std::endl;
+  return same_plans && refused && checked_correct;
+}
+
+// Heap allocations of a long-lived planner solving instances no larger than
+// the ones it has already seen, through the pointer overload of reset. The
+// instances mix shrinking and matching dimensions with uncapacitated ones
+// that go to lot sizing and small ones that go to the specialized solver,
+// which keeps its own buffers and so has its own largest instance in the
+// warm-up; every engine should stay at zero after warm-up.
+// Returns false when some engine, kernel and thread count still allocates
+// once its planner is warmed up.
+bool bench_steady_state_allocations()
+{
+  constexpr int max_periods_count = 400;
+  constexpr int max_store_capacity = 64;
+  constexpr int max_production_capacity = 16;
+  constexpr int solves_count = 200;
+  constexpr int warm_up_count = 3;
+
+  struct Instance
+  {
+    int production_capacity;
+    int store_capacity;
+    std::vector<int> requests;
+  };
+
+  std::mt19937 generator(42);
+  std::vector<Instance> instances;
+  for (int solve = 0; solve < solves_count; ++solve)
+  {
+    const bool largest = solve < warm_up_count;
+    const bool small = solve == warm_up_count - 1;
+    const int periods_count = largest ? max_periods_count : std::uniform_int_distribution<int>(1, max_periods_count)(generator);
+    Instance instance;
+    instance.production_capacity = small ? max_small_capacity : largest ? max_production_capacity : std::uniform_int_distribution<int>(1, max_production_capacity)(generator);
+    instance.store_capacity = small ? max_small_capacity : largest ? max_store_capacity : std::uniform_int_distribution<int>(0, max_store_capacity)(generator);
+    std::uniform_int_distribution<int> demands(0, instance.production_capacity);
+    for (int period = 0; period < periods_count; ++period)
+      instance.requests.push_back(solve % 7 == 1 ? demands(generator) % 2 : demands(generator));
+    if (solve % 7 == 1)
+    {
+      instance.production_capacity = max_periods_count;
+      instance.store_capacity = max_periods_count;
+    }
+    instances.push_back(std::move(instance));
+  }
+
+  std::cout << "steady-state allocations (" << solves_count << " solves, N <= " << max_periods_count << ", S <= "
+            << max_store_capacity << ", P <= " << max_production_capacity << ")" << std::endl;
+  std::cout << std::setw(12) << "engine" << std::setw(16) << "kernel" << std::setw(8) << "threads" << std::setw(14)
+            << "warm-up" << std::setw(14) << "per solve" << std::endl;
+
+  const std::pair<const char *, DpProductionPlanner::Engine> engines[] = {
+      {"table", DpProductionPlanner::Engine::table},
+      {"rolling", DpProductionPlanner::Engine::rolling},
+      {"checkpoint", DpProductionPlanner::Engine::checkpoint},
+      {"min_plus", DpProductionPlanner::Engine::min_plus},
+      {"forward", DpProductionPlanner::Engine::forward},
+  };
+  const std::pair<const char *, DpProductionPlanner::Kernel> kernels[] = {
+      {"scalar", DpProductionPlanner::Kernel::scalar},
+      {"sliding_window", DpProductionPlanner::Kernel::sliding_window},
+      {"simd", DpProductionPlanner::Kernel::simd},
+  };
+  bool allocation_free = true;
+  for (auto [engine_name, engine] : engines)
+  {
+    for (auto [kernel_name, kernel] : kernels)
+    {
+      for (std::size_t threads : {1, 2})
+      {
+        DpProductionPlanner::Options options;
+        options.engine = engine;
+        options.kernel = kernel;
+        options.threads = threads;
+        options.output = DpProductionPlanner::Output::none;
+
+        DpProductionPlanner planner;
+        auto solve = [&](const Instance &instance)
+        {
+          planner.reset(instance.production_capacity, instance.store_capacity, 1, 50, 2, instance.requests.data(),
+                        instance.requests.size(), options);
+          planner.calculate_stages();
+          planner.trace_plan();
+        };
+
+        const std::size_t warm_up_start = allocations_count;
+        for (int solve_it = 0; solve_it < warm_up_count; ++solve_it)
+          solve(instances[solve_it]);
+        const std::size_t steady_start = allocations_count;
+        for (std::size_t solve_it = warm_up_count; solve_it < instances.size(); ++solve_it)
+          solve(instances[solve_it]);
+        const std::size_t steady_end = allocations_count;
+
+        std::cout << std::setw(12) << engine_name << std::setw(16) << kernel_name << std::setw(8) << threads
+                  << std::setw(14) << steady_start - warm_up_start << std::setw(14) << std::fixed
+                  << std::setprecision(2) << double(steady_end - steady_start) / (instances.size() - warm_up_count) << std::endl;
+        allocation_free = allocation_free && steady_end == steady_start;
+      }
+    }
+  }
+
+  if (!allocation_free)
+    std::cout << "FAILED: steady-state solves allocated" << std::endl;
+  return allocation_free;
+}
+
+// Axes and fixed options of the scaling sweep. Each axis is swept with the
+// other two held at their base value.
+struct SweepOptions
+{
+  std::vector<int> periods_counts = {100, 200, 400, 800, 1600};
+  std::vector<int> store_capacities = {64, 128, 256, 512, 1024};
+  std::vector<int> production_capacities = {8, 32, 128, 512};
+  int base_periods_count = 400;
+  int base_store_capacity = 256;
+  int base_production_capacity = 32;
+  std::string engine = "rolling";
+  std::string kernel = "simd";
+  std::size_t threads = 1;
+  // Where the results are written as JSON; empty for none.
+  std::string json_path;
+};
+
+// A non-negative integer; a sign or trailing characters throw
+// std::invalid_argument.
+int parse_count(const std::string &text)
+{
+  std::size_t end = 0;
+  if (text.empty() || text[0] < '0' || text[0] > '9')
+    throw std::invalid_argument("Not a non-negative integer: " + text);
+  const int value = std::stoi(text, &end);
+  if (end != text.size())
+    throw std::invalid_argument("Not a non-negative integer: " + text);
+  return value;
+}
+
+std::vector<int> parse_int_list(const std::string &text)
+{
+  std::vector<int> values;
+  std::size_t start = 0;
+  while (start <= text.size())
+  {
+    const std::size_t end = std::min(text.find(',', start), text.size());
+    values.push_back(parse_count(text.substr(start, end - start)));
+    start = end + 1;
+  }
+  return values;
+}
+
+// Returns freed heap memory to the system and resets the peak resident set
+// size to the current one, which Linux allows since 4.0. Returns false when
+// it cannot, in which case the peak covers the whole process.
+bool reset_peak_rss()
+{
+  malloc_trim(0);
+  std::ofstream clear_refs("/proc/self/clear_refs");
+  clear_refs << "5" << std::flush;
+  return bool(clear_refs);
+}
+
+// Peak resident set size in KiB.
+std::size_t peak_rss_kib()
+{
+  std::ifstream status("/proc/self/status");
+  std::string line;
+  while (std::getline(status, line))
+  {
+    if (line.compare(0, 6, "VmHWM:") == 0)
+      return std::stoul(line.substr(6));
+  }
+
+  rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+}
+
+// Time, memory and allocations of full solves (reset, calculate_stages,
+// trace_plan) as the horizon, the store capacity and the production capacity
+// grow. The time is normalized by the N * (S + 1) * (P + 1) state-decision
+// pairs of the recurrence, so pruned states and the sliding window kernel
+// show up as less than the nominal work. The cost is recorded so that runs
+// diffed between releases also catch changed plans. Where perf_event_open
+// works, the hardware events of calculate_stages are added per solve and
+// per stage; they only cover the calling thread, so with several threads
+// the workers' share is missing.
+void bench_scaling_sweep(const SweepOptions &sweep)
+{
+  constexpr int perf_solves_count = 5;
+
+  DpProductionPlanner::Options options;
+  options.engine = DpProductionPlanner::engine_from_string(sweep.engine);
+  options.kernel = DpProductionPlanner::kernel_from_string(sweep.kernel);
+  options.threads = sweep.threads;
+  options.output = DpProductionPlanner::Output::none;
+  const bool peak_rss_per_point = reset_peak_rss();
+  const PerfCounters perf_counters;
+
+  std::cout << "scaling sweep (" << sweep.engine << " engine, " << sweep.kernel << " kernel, " << sweep.threads
+            << (sweep.threads == 1 ? " thread)" : " threads)") << std::endl;
+  if (!perf_counters.available())
+    std::cout << "hardware counters unavailable (" << perf_counters.why_unavailable() << ")" << std::endl;
+  std::cout << std::setw(8) << "N" << std::setw(8) << "S" << std::setw(8) << "P" << std::setw(14) << "us/solve"
+            << std::setw(16) << "ns/decision" << std::setw(14) << "peak RSS KiB" << std::setw(14) << "cold allocs"
+            << std::setw(14) << "allocs/solve";
+  if (perf_counters.available())
+    std::cout << std::setw(8) << "IPC" << std::setw(18) << "cache miss/stage" << std::setw(18) << "branch miss/stage";
+  std::cout << std::endl;
+
+  json results = json::array();
+  auto run_point = [&](const char *axis, int periods_count, int store_capacity, int production_capacity)
+  {
+    std::mt19937 generator(42);
+    std::uniform_int_distribution<int> demands(0, production_capacity * 3 / 4);
+    std::vector<int> requests(periods_count);
+    for (auto &request : requests)
+      request = demands(generator);
+
+    reset_peak_rss();
+    DpProductionPlanner planner;
+    auto solve = [&]
+    {
+      planner.reset(production_capacity, store_capacity, 1, 50, 2, requests, options);
+      planner.calculate_stages();
+      planner.trace_plan();
+    };
+
+    const std::size_t cold_start = allocations_count;
+    solve();
+    const std::size_t steady_start = allocations_count;
+    solve();
+    const std::size_t steady_end = allocations_count;
+    const std::size_t peak_rss = peak_rss_kib();
+    const double ns = measure_ns(solve);
+    const double state_decisions = double(periods_count) * (store_capacity + 1) * (production_capacity + 1);
+
+    PerfSample perf;
+    for (int solve_it = 0; perf_counters.available() && solve_it < perf_solves_count; ++solve_it)
+    {
+      planner.reset(production_capacity, store_capacity, 1, 50, 2, requests, options);
+      const PerfSample start = perf_counters.read();
+      planner.calculate_stages();
+      perf += perf_counters.read() - start;
+      planner.trace_plan();
+    }
+    auto per_stage = [&](PerfEvent event)
+    {
+      return double(perf[event]) / perf_solves_count / periods_count;
+    };
+
+    std::cout << std::setw(8) << periods_count << std::setw(8) << store_capacity << std::setw(8)
+              << production_capacity << std::setw(14) << std::fixed << std::setprecision(1) << ns / 1000
+              << std::setw(16) << std::setprecision(4) << ns / state_decisions << std::setw(14) << peak_rss
+              << std::setw(14) << steady_start - cold_start << std::setw(14) << steady_end - steady_start;
+    if (perf_counters.available())
+      std::cout << std::setw(8) << std::setprecision(2) << perf.ipc() << std::setw(18) << std::setprecision(1)
+                << per_stage(PerfEvent::cache_misses) << std::setw(18) << per_stage(PerfEvent::branch_misses);
+    std::cout << std::endl;
+
+    json result = {
+        {"axis", axis},
+        {"periods", periods_count},
+        {"store_capacity", store_capacity},
+        {"production_capacity", production_capacity},
+        {"ns_per_solve", ns},
+        {"ns_per_state_decision", ns / state_decisions},
+        {"peak_rss_kib", peak_rss},
+        {"cold_allocations", steady_start - cold_start},
+        {"allocations_per_solve", steady_end - steady_start},
+        {"total_cost", planner.total_cost()},
+    };
+    for (std::size_t event = 0; event < perf_events_count; ++event)
+    {
+      if (!perf.has(PerfEvent(event)))
+        continue;
+      result[std::string(to_string(PerfEvent(event))) + "_per_solve"] = double(perf.values[event]) / perf_solves_count;
+      result[std::string(to_string(PerfEvent(event))) + "_per_stage"] = per_stage(PerfEvent(event));
+    }
+    if (perf.has(PerfEvent::cycles) && perf.has(PerfEvent::instructions))
+      result["ipc"] = perf.ipc();
+    results.push_back(std::move(result));
+  };
+
+  for (int periods_count : sweep.periods_counts)
+    run_point("periods", periods_count, sweep.base_store_capacity, sweep.base_production_capacity);
+  for (int store_capacity : sweep.store_capacities)
+    run_point("store_capacity", sweep.base_periods_count, store_capacity, sweep.base_production_capacity);
+  for (int production_capacity : sweep.production_capacities)
+    run_point("production_capacity", sweep.base_periods_count, sweep.base_store_capacity, production_capacity);
+
+  if (sweep.json_path.empty())
+    return;
+
+  const json report = {
+      {"engine", sweep.engine},
+      {"kernel", sweep.kernel},
+      {"threads", sweep.threads},
+      {"instruction_set", to_string(detect_instruction_set())},
+      {"peak_rss_per_point", peak_rss_per_point},
+      {"perf_unavailable", perf_counters.available() ? json(nullptr) : json(perf_counters.why_unavailable())},
+      {"results", results},
+  };
+  std::ofstream output(sweep.json_path);
+  output << report.dump(2) << std::endl;
+  if (!output)
+    std::cerr << "Cannot write " << sweep.json_path << std::endl;
+}
+
+void print_usage(const char *program)
+{
+  std::cerr << "Usage: " << program << " [all|kernel|table|engines|threads|segments|min_plus|update|append|batch|lot|small|cost|alloc|sweep]" << std::endl
+            << "       " << program << " sweep [--periods=N,...] [--store=S,...] [--production=P,...]" << std::endl
+            << "             [--base=N,S,P] [--engine=E] [--kernel=K] [--threads=T] [--json=path]" << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+  const std::string section = argc > 1 ? argv[1] : "all";
+  const char *const sections[] = {"all", "kernel", "table", "engines", "threads", "segments", "min_plus", "update", "append", "batch", "lot", "small", "cost", "alloc", "sweep"};
+  if (std::find(std::begin(sections), std::end(sections), section) == std::end(sections))
+  {
+    print_usage(argv[0]);
+    return 1;
+  }
+
+  SweepOptions sweep;
+  try
+  {
+    for (int arg = 2; arg < argc; ++arg)
+    {
+      const std::string option = argv[arg];
+      const std::size_t equals = option.find('=');
+      const std::string name = option.substr(0, equals);
+      const std::string value = equals == std::string::npos ? "" : option.substr(equals + 1);
+      if (section != "sweep" || value.empty())
+      {
+        print_usage(argv[0]);
+        return 1;
+      }
+
+      if (name == "--periods")
+        sweep.periods_counts = parse_int_list(value);
+      else if (name == "--store")
+        sweep.store_capacities = parse_int_list(value);
+      else if (name == "--production")
+        sweep.production_capacities = parse_int_list(value);
+      else if (name == "--base")
+      {
+        const std::vector<int> base = parse_int_list(value);
+        if (base.size() != 3)
+        {
+          print_usage(argv[0]);
+          return 1;
+        }
+        sweep.base_periods_count = base[0];
+        sweep.base_store_capacity = base[1];
+        sweep.base_production_capacity = base[2];
+      }
+      else if (name == "--engine")
+      {
+        DpProductionPlanner::engine_from_string(value);
+        sweep.engine = value;
+      }
+      else if (name == "--kernel")
+      {
+        DpProductionPlanner::kernel_from_string(value);
+        sweep.kernel = value;
+      }
+      else if (name == "--threads")
+        sweep.threads = parse_count(value);
+      else if (name == "--json")
+        sweep.json_path = value;
+      else
+      {
+        print_usage(argv[0]);
+        return 1;
+      }
+    }
+  }
+  catch (const std::exception &exception)
+  {
+    std::cerr << exception.what() << std::endl;
+    print_usage(argv[0]);
+    return 1;
+  }
+
+  bool passed = true;
+  if (section == "all" || section == "kernel")
+    passed = bench_decision_kernel() && passed;
+  if (section == "all" || section == "table")
+    bench_table_rendering();
+  if (section == "all" || section == "engines")
+    passed = bench_engines() && passed;
+  if (section == "all" || section == "threads")
+    passed = bench_threads() && passed;
+  if (section == "all" || section == "segments")
+    passed = bench_segments() && passed;
+  if (section == "all" || section == "min_plus")
+    passed = bench_min_plus() && passed;
+  if (section == "all" || section == "update")
+    passed = bench_request_update() && passed;
+  if (section == "all" || section == "append")
+    passed = bench_request_append() && passed;
+  if (section == "all" || section == "batch")
+    passed = bench_scenario_batch() && passed;
+  if (section == "all" || section == "lot")
+    passed = bench_lot_sizing() && passed;
+  if (section == "all" || section == "small")
+    passed = bench_small_capacities() && passed;
+  if (section == "all" || section == "cost")
+    passed = bench_cost_types() && passed;
+  if (section == "all" || section == "alloc")
+    passed = bench_steady_state_allocations() && passed;
+  if (section == "all" || section == "sweep")
+    bench_scaling_sweep(sweep);
+
+  return passed ? 0 : 1;
+}
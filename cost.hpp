@@ -0,0 +1,160 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <string>
+
+// A 64-bit cost whose arithmetic throws std::overflow_error instead of
+// wrapping around. Integers convert to it implicitly, so it drops into the
+// planner's cost expressions; converting back is explicit.
+class CheckedCost
+{
+public:
+  constexpr CheckedCost() = default;
+
+  constexpr CheckedCost(long long i_value) : value(i_value)
+  {
+  }
+
+  constexpr explicit operator long long() const
+  {
+    return value;
+  }
+
+  friend CheckedCost operator+(CheckedCost left, CheckedCost right)
+  {
+    long long result;
+    if (__builtin_add_overflow(left.value, right.value, &result))
+      throw std::overflow_error("Cost overflow");
+    return result;
+  }
+
+  friend CheckedCost operator-(CheckedCost left, CheckedCost right)
+  {
+    long long result;
+    if (__builtin_sub_overflow(left.value, right.value, &result))
+      throw std::overflow_error("Cost overflow");
+    return result;
+  }
+
+  friend CheckedCost operator*(CheckedCost left, CheckedCost right)
+  {
+    long long result;
+    if (__builtin_mul_overflow(left.value, right.value, &result))
+      throw std::overflow_error("Cost overflow");
+    return result;
+  }
+
+  CheckedCost &operator+=(CheckedCost other)
+  {
+    return *this = *this + other;
+  }
+
+  friend constexpr bool operator==(CheckedCost left, CheckedCost right) { return left.value == right.value; }
+  friend constexpr bool operator!=(CheckedCost left, CheckedCost right) { return left.value != right.value; }
+  friend constexpr bool operator<(CheckedCost left, CheckedCost right) { return left.value < right.value; }
+  friend constexpr bool operator>(CheckedCost left, CheckedCost right) { return left.value > right.value; }
+  friend constexpr bool operator<=(CheckedCost left, CheckedCost right) { return left.value <= right.value; }
+  friend constexpr bool operator>=(CheckedCost left, CheckedCost right) { return left.value >= right.value; }
+
+private:
+  long long value = 0;
+};
+
+namespace std
+{
+template <>
+struct numeric_limits<CheckedCost>
+{
+  static constexpr bool is_specialized = true;
+  static constexpr bool is_signed = true;
+  static constexpr bool is_integer = true;
+
+  static constexpr CheckedCost min() { return numeric_limits<long long>::min(); }
+  static constexpr CheckedCost lowest() { return numeric_limits<long long>::lowest(); }
+  static constexpr CheckedCost max() { return numeric_limits<long long>::max(); }
+};
+}
+
+// The cost type a planner accumulates stage costs in. Narrower types keep
+// more states per cache line and vector register; automatic picks the
+// narrowest one select_cost_type proves safe for the instance.
+enum class CostType
+{
+  automatic,
+  int16,
+  int32,
+  int64,
+  // 64-bit, throwing std::overflow_error on overflow.
+  checked,
+};
+
+inline CostType cost_type_from_string(const std::string &name)
+{
+  if (name == "auto")
+    return CostType::automatic;
+  if (name == "int16")
+    return CostType::int16;
+  if (name == "int32")
+    return CostType::int32;
+  if (name == "int64")
+    return CostType::int64;
+  if (name == "checked")
+    return CostType::checked;
+
+  throw std::invalid_argument("Unknown cost type: " + name);
+}
+
+inline const char *to_string(CostType cost_type)
+{
+  switch (cost_type)
+  {
+  case CostType::int16:
+    return "int16";
+  case CostType::int32:
+    return "int32";
+  case CostType::int64:
+    return "int64";
+  case CostType::checked:
+    return "checked";
+  default:
+    return "auto";
+  }
+}
+
+// Every finite stage cost is the cost of a partial plan, which pays at most
+// the constant production cost and a full store in each period, so
+// periods_count * (constant_production_cost + store_cost * store_capacity)
+// bounds every cost the stages hold or compare. The largest value of a type
+// marks infeasible entries, so the bound must stay below it. The per-unit
+// good cost is added to the total outside the stages and does not count. A
+// horizon that grows through append_request needs the bound of its longest
+// length.
+// Stores N * (K + h * S), a bound on the stage cost of any plan, in bound;
+// returns false when it does not fit 64 bits.
+inline bool stage_cost_bound(std::size_t periods_count, std::size_t store_capacity, std::size_t store_cost,
+                             std::size_t constant_production_cost, unsigned long long &bound)
+{
+  unsigned long long period_cost;
+  return !__builtin_mul_overflow((unsigned long long)store_cost, (unsigned long long)store_capacity, &period_cost) &&
+         !__builtin_add_overflow(period_cost, (unsigned long long)constant_production_cost, &period_cost) &&
+         !__builtin_mul_overflow(period_cost, (unsigned long long)periods_count, &bound);
+}
+
+inline CostType select_cost_type(std::size_t periods_count, std::size_t store_capacity, std::size_t store_cost,
+                                 std::size_t constant_production_cost)
+{
+  unsigned long long bound;
+  if (!stage_cost_bound(periods_count, store_capacity, store_cost, constant_production_cost, bound))
+    return CostType::checked;
+
+  if (bound < (unsigned long long)std::numeric_limits<std::int16_t>::max())
+    return CostType::int16;
+  if (bound < (unsigned long long)std::numeric_limits<std::int32_t>::max())
+    return CostType::int32;
+  if (bound < (unsigned long long)std::numeric_limits<std::int64_t>::max())
+    return CostType::int64;
+  return CostType::checked;
+}
@@ -0,0 +1,1820 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "argmin.hpp"
+#include "cost.hpp"
+#include "instrumentation.hpp"
+#include "li_chao_tree.hpp"
+#include "min_plus.hpp"
+#include "small_capacity.hpp"
+#include "table.hpp"
+#include "thread_pool.hpp"
+#include "trace.hpp"
+
+// Engines, kernels and options shared by the planners of every cost type.
+class DpProductionPlannerBase
+{
+public:
+  static constexpr int no_decision = -1;
+
+  enum class Engine
+  {
+    // Keeps every stage's cost row and per-decision costs (full stage tables).
+    table,
+    // Keeps two cost rows and only the optimal decision per (stage, state).
+    rolling,
+    // Keeps a cost row every ~sqrt(N) stages and recomputes each segment's
+    // decisions during trace_stages: about twice the work in O(sqrt(N) * S).
+    checkpoint,
+    // Treats every stage as a banded (min, +) matrix and reduces blocks of
+    // stages in a parallel tree, so long horizons with a small store use all
+    // threads even when a single stage is too small to split. Keeps every
+    // cost row and optimal decision; when the products cannot pay off (few
+    // threads for the store, or an external executor) it runs the stages one
+    // by one like the rolling engine.
+    min_plus,
+    // Runs the recurrence forward in time: stage t is period t and its states
+    // are the inventory left after it, so append_request extends the horizon
+    // by computing a single stage. Only states reachable from the empty
+    // initial store are pruned, and ties may resolve to a different plan of
+    // the same cost than the backward engines.
+    forward,
+  };
+
+  static Engine engine_from_string(const std::string &name)
+  {
+    if (name == "table")
+      return Engine::table;
+    if (name == "rolling")
+      return Engine::rolling;
+    if (name == "checkpoint")
+      return Engine::checkpoint;
+    if (name == "min_plus")
+      return Engine::min_plus;
+    if (name == "forward")
+      return Engine::forward;
+
+    throw std::invalid_argument("Unknown engine: " + name);
+  }
+
+  enum class Kernel
+  {
+    // Evaluates every production quantity of every state: O(S * P) per stage.
+    scalar,
+    // Takes the minimum over the window of reachable next-stage states with a
+    // monotone queue: O(S) per stage.
+    sliding_window,
+    // Same work as scalar, with the minimum over positive production
+    // quantities taken by a vectorized argmin (AVX2, SSE4.1 or scalar,
+    // picked at runtime).
+    simd,
+    // The table engine always uses the scalar kernel since it records the
+    // cost of every decision, and the forward engine its own O(S * P) loop.
+  };
+
+  static Kernel kernel_from_string(const std::string &name)
+  {
+    if (name == "scalar")
+      return Kernel::scalar;
+    if (name == "sliding_window")
+      return Kernel::sliding_window;
+    if (name == "simd")
+      return Kernel::simd;
+
+    throw std::invalid_argument("Unknown kernel: " + name);
+  }
+
+  enum class Output
+  {
+    // Nothing is printed; read the plan through trace_plan and decisions.
+    none,
+    // trace_stages prints the optimal decisions and total cost.
+    summary,
+    // calculate_stages also prints every stage's table.
+    full,
+  };
+
+  static Output output_from_string(const std::string &name)
+  {
+    if (name == "none")
+      return Output::none;
+    if (name == "summary")
+      return Output::summary;
+    if (name == "full")
+      return Output::full;
+
+    throw std::invalid_argument("Unknown output: " + name);
+  }
+
+  struct Options
+  {
+    Engine engine = Engine::table;
+    Kernel kernel = Kernel::scalar;
+    // Restrict every stage to the inventory levels that can be reached from
+    // the empty initial store and still be used up by the end of the horizon.
+    bool prune_states = true;
+    // Solve uncapacitated instances by Wagner-Whitin lot sizing instead of
+    // the stage tables (backward engines, unless the full stage tables are
+    // printed).
+    bool lot_sizing = true;
+    // Solve instances with both capacities at most max_small_capacity with a
+    // solver specialized for them at compile time (backward engines, unless
+    // the full stage tables are printed).
+    bool specialize_small_capacities = true;
+    // With several threads, solve the segments between regeneration points
+    // concurrently (table and forward engines); see calculate_segments.
+    bool split_segments = true;
+    // Worker threads evaluating the states of a stage; 0 uses one per core.
+    std::size_t threads = 1;
+    Output output = Output::summary;
+    // Runs the chunks of each stage on an external executor, such as a
+    // worker of a WorkStealingExecutor, instead of an own thread pool;
+    // threads is ignored when set.
+    ParallelFor *executor = nullptr;
+  };
+};
+
+// Plans production over a horizon with stage costs accumulated in Cost: a
+// signed integer type or CheckedCost. Every finite stage cost must stay below
+// the largest Cost, which marks infeasible entries; select_cost_type picks
+// the narrowest type that guarantees it for an instance.
+template <typename Cost>
+class BasicDpProductionPlanner : public DpProductionPlannerBase
+{
+public:
+  static constexpr Cost infeasible_cost = std::numeric_limits<Cost>::max();
+
+private:
+  // All stages live in a few contiguous arrays (structure of arrays) indexed
+  // stage-major; infeasible entries hold the sentinels above instead of an
+  // empty std::optional. A stage only stores the inventory levels between its
+  // first and last state. Cost and decision rows are reused modulo
+  // cost_rows_count and decision_rows_count, so the rolling engine keeps two
+  // cost rows and the checkpoint engine one segment of decision rows, and
+  // decision costs are only kept by the table engine (decisions_count is zero
+  // otherwise).
+  struct StageTable
+  {
+    std::size_t stages_count = 0;
+    std::size_t states_count = 0;
+    std::size_t decisions_count = 0;
+    std::size_t cost_rows_count = 0;
+    std::size_t decision_rows_count = 0;
+    std::size_t checkpoint_interval = 0;
+
+    // The row of a stage is empty when its first state exceeds its last one.
+    std::vector<int> first_states;
+    std::vector<int> last_states;
+    // Start of each stage's row in arrays that hold every stage.
+    std::vector<std::size_t> row_offsets;
+
+    std::vector<Cost> decision_costs;
+    std::vector<Cost> optimal_costs;
+    std::vector<int> optimal_decisions;
+    // Cost row of every stage checkpoint_interval * k - 1, k >= 1.
+    std::vector<Cost> checkpoint_costs;
+
+    bool contains(std::size_t stage, int state) const
+    {
+      return first_states[stage] <= state && state <= last_states[stage];
+    }
+
+    std::size_t row_width(std::size_t stage) const
+    {
+      return std::max(last_states[stage] - first_states[stage] + 1, 0);
+    }
+
+    std::size_t row_offset(std::size_t stage, std::size_t rows_count) const
+    {
+      if (rows_count == stages_count)
+        return row_offsets[stage];
+      return (stage % rows_count) * states_count;
+    }
+
+    std::size_t rows_size(std::size_t rows_count) const
+    {
+      if (rows_count == stages_count)
+        return row_offsets.empty() ? 0 : row_offsets.back() + row_width(stages_count - 1);
+      return rows_count * states_count;
+    }
+
+    Cost *decisions(std::size_t stage, int state)
+    {
+      if (decision_costs.empty())
+        return nullptr;
+      return decision_costs.data() + (row_offsets[stage] + state - first_states[stage]) * decisions_count;
+    }
+
+    const Cost *decisions(std::size_t stage, int state) const
+    {
+      if (decision_costs.empty())
+        return nullptr;
+      return decision_costs.data() + (row_offsets[stage] + state - first_states[stage]) * decisions_count;
+    }
+
+    // Rows returned by cost_row and decision_row start at the stage's first
+    // state.
+    Cost *cost_row(std::size_t stage)
+    {
+      return optimal_costs.data() + row_offset(stage, cost_rows_count);
+    }
+
+    const Cost *cost_row(std::size_t stage) const
+    {
+      return optimal_costs.data() + row_offset(stage, cost_rows_count);
+    }
+
+    Cost optimal_cost(std::size_t stage, int state) const
+    {
+      if (!contains(stage, state))
+        return infeasible_cost;
+      return cost_row(stage)[state - first_states[stage]];
+    }
+
+    int *decision_row(std::size_t stage)
+    {
+      return optimal_decisions.data() + row_offset(stage, decision_rows_count);
+    }
+
+    const int *decision_row(std::size_t stage) const
+    {
+      return optimal_decisions.data() + row_offset(stage, decision_rows_count);
+    }
+
+    int optimal_decision(std::size_t stage, int state) const
+    {
+      if (!contains(stage, state))
+        return no_decision;
+      return decision_row(stage)[state - first_states[stage]];
+    }
+
+    Cost *checkpoint_row(std::size_t segment)
+    {
+      return checkpoint_costs.data() + (segment - 1) * states_count;
+    }
+  };
+
+  // Bounds the inventory entering each period from both ends of the horizon:
+  // forward from the empty initial store (at most production_capacity more
+  // than was left, at least demand less) and backward from the empty final
+  // store. Stages are indexed in reverse, like reversed_requests.
+  static void init_state_bounds(std::vector<int> &first_states, std::vector<int> &last_states, bool prune_states,
+                                int production_capacity, int store_capacity, const std::vector<int> &requests)
+  {
+    const int stages_count = requests.size();
+    first_states.assign(stages_count, 0);
+    last_states.assign(stages_count, store_capacity);
+    if (!prune_states)
+      return;
+
+    long long first = 0;
+    long long last = 0;
+    for (int period = 0; period < stages_count; ++period)
+    {
+      const int stage = stages_count - 1 - period;
+      if (first > last)
+      {
+        first_states[stage] = 1;
+        last_states[stage] = 0;
+        continue;
+      }
+
+      first_states[stage] = first;
+      last_states[stage] = last;
+      first = std::max(first - requests[period], 0LL);
+      last = std::min<long long>(last + production_capacity - requests[period], store_capacity);
+    }
+
+    first = 0;
+    last = 0;
+    for (int stage = 0; stage < stages_count; ++stage)
+    {
+      const int period = stages_count - 1 - stage;
+      first = std::max<long long>(first - production_capacity + requests[period], 0);
+      last = std::min<long long>(last + requests[period], store_capacity);
+      if (first > last)
+      {
+        std::fill(first_states.begin() + stage, first_states.end(), 1);
+        std::fill(last_states.begin() + stage, last_states.end(), 0);
+        break;
+      }
+
+      first_states[stage] = std::max<long long>(first_states[stage], first);
+      last_states[stage] = std::min<long long>(last_states[stage], last);
+    }
+  }
+
+  static void init_row_offsets(StageTable &stages, std::size_t first_stage)
+  {
+    std::size_t row_offset = first_stage > 0 ? stages.row_offsets[first_stage - 1] + stages.row_width(first_stage - 1) : 0;
+    for (std::size_t stage = first_stage; stage < stages.stages_count; ++stage)
+    {
+      stages.row_offsets[stage] = row_offset;
+      row_offset += stages.row_width(stage);
+    }
+  }
+
+  // Forward stages only know the periods up to their own, so their states are
+  // bounded from the empty initial store alone.
+  static void init_forward_state_bounds(std::vector<int> &first_states, std::vector<int> &last_states,
+                                        bool prune_states, int production_capacity, int store_capacity,
+                                        const std::vector<int> &requests)
+  {
+    first_states.resize(requests.size());
+    last_states.resize(requests.size());
+    for (std::size_t stage = 0; stage < requests.size(); ++stage)
+      bound_forward_stage(first_states, last_states, stage, prune_states, production_capacity, store_capacity, requests[stage]);
+  }
+
+  static void bound_forward_stage(std::vector<int> &first_states, std::vector<int> &last_states, std::size_t stage,
+                                  bool prune_states, int production_capacity, int store_capacity, int request)
+  {
+    if (!prune_states)
+    {
+      first_states[stage] = 0;
+      last_states[stage] = store_capacity;
+      return;
+    }
+
+    const long long first = stage > 0 ? first_states[stage - 1] : 0;
+    const long long last = stage > 0 ? last_states[stage - 1] : 0;
+    if (first > last)
+    {
+      first_states[stage] = 1;
+      last_states[stage] = 0;
+      return;
+    }
+
+    first_states[stage] = std::max(first - request, 0LL);
+    last_states[stage] = std::min<long long>(last + production_capacity - request, store_capacity);
+  }
+
+  // Lays out the stages of a new instance, reusing the storage of the previous
+  // one where it is large enough.
+  static void init_stages(StageTable &stages, const Options &options, int production_capacity, int store_capacity,
+                          const std::vector<int> &requests)
+  {
+    stages.stages_count = requests.size();
+    stages.states_count = store_capacity + 1;
+    stages.decisions_count = options.engine == Engine::table ? production_capacity + 1 : 0;
+    const bool all_cost_rows = options.engine == Engine::table || options.engine == Engine::min_plus ||
+                               options.engine == Engine::forward;
+    stages.cost_rows_count = all_cost_rows ? stages.stages_count : std::min(stages.stages_count, std::size_t(2));
+    stages.checkpoint_interval = std::max(std::size_t(std::ceil(std::sqrt(double(stages.stages_count)))), std::size_t(1));
+    stages.decision_rows_count = options.engine == Engine::checkpoint ? std::min(stages.stages_count, stages.checkpoint_interval) : stages.stages_count;
+
+    if (options.engine == Engine::forward)
+      init_forward_state_bounds(stages.first_states, stages.last_states, options.prune_states, production_capacity,
+                                store_capacity, requests);
+    else
+      init_state_bounds(stages.first_states, stages.last_states, options.prune_states, production_capacity,
+                        store_capacity, requests);
+    stages.row_offsets.resize(stages.stages_count);
+    init_row_offsets(stages, 0);
+
+    stages.decision_costs.assign(stages.rows_size(stages.stages_count) * stages.decisions_count, infeasible_cost);
+    stages.optimal_costs.assign(stages.rows_size(stages.cost_rows_count), infeasible_cost);
+    stages.optimal_decisions.assign(stages.rows_size(stages.decision_rows_count), no_decision);
+    if (options.engine == Engine::checkpoint && stages.stages_count > 0)
+      stages.checkpoint_costs.assign((stages.stages_count - 1) / stages.checkpoint_interval * stages.states_count, infeasible_cost);
+    else
+      stages.checkpoint_costs.clear();
+  }
+
+  template <typename Value>
+  static std::string_view cell_text(Value value, Value none, TableRenderer::CellBuffer &scratch)
+  {
+    if (value == none)
+      return "-";
+
+    return TableRenderer::format(static_cast<long long>(value), scratch);
+  }
+
+  void print_stage(std::size_t stage)
+  {
+    const TraceSpan span("print_stage", "stage", stage);
+    const std::size_t decisions_count = stages.decisions_count;
+    const std::size_t columns_count = decisions_count + 3;
+
+    stage_renderer.render(std::cout, stages.states_count + 1, columns_count,
+                          [&](std::size_t row, std::size_t column, TableRenderer::CellBuffer &scratch) -> std::string_view
+                          {
+                            if (row == 0)
+                            {
+                              if (column == 0)
+                                return decisions_count > 0 ? "s\\x" : "s";
+                              if (column == columns_count - 2)
+                                return "optimal cost";
+                              if (column == columns_count - 1)
+                                return "x*";
+                              return TableRenderer::format(column - 1, scratch);
+                            }
+
+                            const int state = row - 1;
+                            if (column == 0)
+                              return TableRenderer::format(state, scratch);
+                            if (column == columns_count - 2)
+                              return cell_text(stages.optimal_cost(stage, state), infeasible_cost, scratch);
+                            if (column == columns_count - 1)
+                              return cell_text(stages.optimal_decision(stage, state), no_decision, scratch);
+                            if (!stages.contains(stage, state))
+                              return "-";
+                            return cell_text(stages.decisions(stage, state)[column - 1], infeasible_cost, scratch);
+                          });
+    std::cout << '\n';
+  }
+
+  Engine engine = Engine::table;
+  Kernel kernel = Kernel::scalar;
+  Output output = Output::summary;
+  bool prune_states = true;
+  bool lot_sizing = true;
+  bool specialize_small_capacities = true;
+  bool split_segments = true;
+  std::size_t threads_count = 1;
+  std::size_t production_capacity = 0;
+  std::size_t store_capacity = 0;
+  Cost store_cost = 0;
+  Cost constant_production_cost = 0;
+  std::size_t good_production_cost = 0;
+  // Set when a single production run may cover the whole horizon; such
+  // instances are classic uncapacitated lot sizing and skip the stage tables.
+  bool uncapacitated = false;
+  // Set for instances solved by a specialized small capacity solver, which
+  // skip the stage tables as well.
+  SmallCapacitySolver<Cost> small_capacity_solver = nullptr;
+
+  StageTable stages;
+  std::vector<int> requests;
+  // Requests in the order of the backward stages; empty for the forward
+  // engine, whose stage t is period t.
+  std::vector<int> reversed_requests;
+  Cost optimal_plan_cost = infeasible_cost;
+  std::unique_ptr<ThreadPool> thread_pool;
+  ParallelFor *executor = nullptr;
+  // The executor or own thread pool running stage chunks, if any.
+  ParallelFor *parallel = nullptr;
+
+  // Min-plus product of the transforms of stages [first_stage, last_stage]:
+  // entry (s, j) is the cheapest cost from state s of last_stage down to state
+  // j of first_stage - 1 (the empty store when first_stage is 0).
+  struct TransformProduct
+  {
+    int first_stage = 0;
+    int last_stage = 0;
+    std::size_t rows_count = 0;
+    std::size_t columns_count = 0;
+    std::vector<Cost> costs;
+    // The cost row entering the product, over the states of first_stage - 1.
+    std::vector<Cost> input;
+    // Product of the stages so far while multiplying a block.
+    std::vector<Cost> partial_costs;
+    // First and one past the last finite column of every row of costs and
+    // partial_costs while multiplying a block.
+    std::vector<std::pair<std::size_t, std::size_t>> column_ranges;
+    std::vector<std::pair<std::size_t, std::size_t>> partial_column_ranges;
+  };
+
+  // Level 0 holds one product per block of stages, every further level the
+  // products of pairs of nodes below it.
+  // Levels only ever grow, so their products keep their storage; the nodes
+  // of the current instance are the first level_sizes[level] of each.
+  std::vector<std::vector<TransformProduct>> product_levels;
+  std::vector<std::size_t> level_sizes;
+  // Stages whose only state is the empty store, and the cost every segment
+  // between them is shifted by; see calculate_segments.
+  std::vector<int> regeneration_stages;
+  std::vector<Cost> segment_offsets;
+  TableRenderer stage_renderer;
+  BasicArgminFunction<Cost> argmin = select_argmin<Cost>();
+  // One monotone queue of next-stage states per worker for the sliding window
+  // kernel.
+  std::vector<int> window_states;
+  std::vector<int> lot_sizing_decisions;
+  std::vector<long long> lot_sizing_demand_sums;
+  std::vector<long long> lot_sizing_weighted_sums;
+  std::vector<long long> lot_sizing_costs;
+  LiChaoTree lot_sizing_envelope;
+  std::size_t skipped_states = 0;
+  // State bounds of the instance after update_request, compared against the
+  // current layout.
+  std::vector<int> updated_first_states;
+  std::vector<int> updated_last_states;
+
+  std::vector<int> plan_decisions;
+  std::size_t plan_total_cost = 0;
+  // Stage counters of each worker, worker-major; only sized when built with
+  // DP_INSTRUMENTATION.
+  std::vector<StageCounters> worker_stage_counters;
+
+  static Cost to_cost(std::size_t value)
+  {
+    if ((unsigned long long)value >= (unsigned long long)static_cast<long long>(infeasible_cost))
+      throw std::overflow_error("Cost " + std::to_string(value) + " does not fit the cost type");
+    return static_cast<Cost>(value);
+  }
+
+  // Throws std::overflow_error unless every stage cost of a horizon of
+  // periods_count periods fits Cost. CheckedCost reports overflow itself, as
+  // it happens.
+  void check_cost_bound(std::size_t periods_count) const
+  {
+    if constexpr (std::is_same_v<Cost, CheckedCost>)
+      return;
+
+    unsigned long long bound;
+    if (!stage_cost_bound(periods_count, store_capacity, static_cast<long long>(store_cost),
+                          static_cast<long long>(constant_production_cost), bound) ||
+        bound >= (unsigned long long)static_cast<long long>(infeasible_cost))
+      throw std::overflow_error("Costs of " + std::to_string(periods_count) + " periods do not fit the cost type");
+  }
+
+  static bool is_uncapacitated(std::size_t production_capacity, std::size_t store_capacity, const std::vector<int> &requests)
+  {
+    if (requests.empty() || std::any_of(requests.begin(), requests.end(), [](int request)
+                                        { return request < 0; }))
+      return false;
+
+    const std::size_t total_demand = std::accumulate(requests.begin(), requests.end(), std::size_t(0));
+    return production_capacity >= total_demand && store_capacity >= total_demand - requests.front();
+  }
+
+  // Whether calculate_lot_sizing's 64-bit sums cannot overflow: they stay
+  // within twice N * (K + h * D) for a total demand D.
+  bool lot_sizing_fits() const
+  {
+    const std::size_t total_demand = std::accumulate(requests.begin(), requests.end(), std::size_t(0));
+    unsigned long long bound;
+    return stage_cost_bound(requests.size(), total_demand, static_cast<long long>(store_cost),
+                            static_cast<long long>(constant_production_cost), bound) &&
+           bound < (unsigned long long)std::numeric_limits<long long>::max() / 4;
+  }
+
+  // Whether the current instance is solved by calculate_lot_sizing.
+  bool uses_lot_sizing() const
+  {
+    return lot_sizing && engine != Engine::forward && output != Output::full &&
+           is_uncapacitated(production_capacity, store_capacity, requests) && lot_sizing_fits();
+  }
+
+  // Wagner-Whitin lot sizing. Some optimal plan only produces when the store
+  // is empty, so the cost from period i on is F(i) = F(i + 1) when i has no
+  // demand and otherwise
+  //   F(i) = K + min_{j >= i} h * sum_{i < k <= j} (k - i) * d_k + F(j + 1).
+  // Expanding the holding sum with prefix sums makes each candidate j a line
+  // in i, so the minimum is a lower envelope query. The plan is traced
+  // forward taking the smallest optimal run, the same tie-breaking as
+  // trace_stages.
+  void calculate_lot_sizing()
+  {
+    const TraceSpan span("lot_sizing", "periods", requests.size());
+    const long long periods_count = requests.size();
+    const long long holding = static_cast<long long>(store_cost);
+    const long long setup = static_cast<long long>(constant_production_cost);
+
+    // demand_sums[m] = sum_{k < m} d_k, weighted_sums[m] = sum_{k < m} k * d_k
+    std::vector<long long> &demand_sums = lot_sizing_demand_sums;
+    std::vector<long long> &weighted_sums = lot_sizing_weighted_sums;
+    demand_sums.assign(periods_count + 1, 0);
+    weighted_sums.assign(periods_count + 1, 0);
+    for (long long k = 0; k < periods_count; ++k)
+    {
+      demand_sums[k + 1] = demand_sums[k] + requests[k];
+      weighted_sums[k + 1] = weighted_sums[k] + k * requests[k];
+    }
+
+    auto run_cost = [&](long long first, long long last)
+    {
+      const long long holding_units = weighted_sums[last + 1] - weighted_sums[first] -
+                                      first * (demand_sums[last + 1] - demand_sums[first]);
+      return setup + holding * holding_units;
+    };
+
+    std::vector<long long> &costs = lot_sizing_costs;
+    costs.assign(periods_count + 1, 0);
+    LiChaoTree &envelope = lot_sizing_envelope;
+    envelope.reset(periods_count);
+    for (long long i = periods_count - 1; i >= 0; --i)
+    {
+      envelope.insert(holding * weighted_sums[i + 1] + costs[i + 1], -holding * demand_sums[i + 1]);
+
+      if (requests[i] == 0)
+        costs[i] = costs[i + 1];
+      else
+        costs[i] = setup + envelope.minimum(i) - holding * (weighted_sums[i] - i * demand_sums[i]);
+    }
+
+    lot_sizing_decisions.assign(periods_count, 0);
+    for (long long i = 0; i < periods_count;)
+    {
+      if (requests[i] == 0)
+      {
+        ++i;
+        continue;
+      }
+
+      long long last = i;
+      while (run_cost(i, last) + costs[last + 1] != costs[i])
+        ++last;
+
+      lot_sizing_decisions[i] = demand_sums[last + 1] - demand_sums[i];
+      i = last + 1;
+    }
+
+    optimal_plan_cost = costs[0];
+  }
+
+  // The stage tables are left empty, so the decision rows of the specialized
+  // solver reuse their storage.
+  void calculate_small_capacities()
+  {
+    const TraceSpan span("small_capacities", "periods", requests.size());
+    stages.optimal_decisions.resize(requests.size() * (store_capacity + 1));
+    optimal_plan_cost = small_capacity_solver(requests.data(), requests.size(), store_cost, constant_production_cost,
+                                              stages.optimal_decisions.data());
+  }
+
+  bool trace_small_capacity_decisions()
+  {
+    plan_decisions.clear();
+    if (optimal_plan_cost == infeasible_cost)
+      return false;
+
+    int state = 0;
+    for (int stage = int(requests.size()) - 1; stage >= 0; --stage)
+    {
+      const int optimal_decision = stages.optimal_decisions[stage * (store_capacity + 1) + state];
+      plan_decisions.push_back(optimal_decision);
+      if (stage > 0)
+        state += optimal_decision - reversed_requests[stage];
+    }
+    return true;
+  }
+
+  bool is_segment_end(std::size_t stage) const
+  {
+    return stage + 1 == stages.stages_count || (stage + 1) % stages.checkpoint_interval == 0;
+  }
+
+  void save_checkpoint(std::size_t stage)
+  {
+    if (engine == Engine::checkpoint && is_segment_end(stage) && stage + 1 < stages.stages_count)
+    {
+      const std::size_t next_segment = (stage + 1) / stages.checkpoint_interval;
+      std::copy_n(stages.cost_row(stage), stages.row_width(stage), stages.checkpoint_row(next_segment));
+    }
+  }
+
+  // Recomputes the decision rows of the checkpoint segment holding stage,
+  // starting from the cost row saved before the segment.
+  void restore_segment(std::size_t stage)
+  {
+    const TraceSpan span("restore_segment", "stage", stage);
+    const std::size_t segment = stage / stages.checkpoint_interval;
+    const std::size_t first_stage = segment * stages.checkpoint_interval;
+    if (segment > 0)
+      std::copy_n(stages.checkpoint_row(segment), stages.row_width(first_stage - 1), stages.cost_row(first_stage - 1));
+
+    for (std::size_t stage_it = first_stage; stage_it <= stage; ++stage_it)
+      calculate_stage(stage_it);
+  }
+
+  // States of one stage only read the previous stage, so with a thread pool
+  // they are split into chunks evaluated concurrently.
+  void calculate_stage(int stage_it)
+  {
+    constexpr int min_chunk_size = 256;
+
+    const ParallelFor::Task task = [this, stage_it](std::size_t worker, int first_state, int last_state)
+    {
+      calculate_states(stage_it, first_state, last_state, worker);
+    };
+
+    if (parallel)
+      parallel->parallel_for(stages.first_states[stage_it], stages.last_states[stage_it], min_chunk_size, task);
+    else if (stages.row_width(stage_it) > 0)
+      task(0, stages.first_states[stage_it], stages.last_states[stage_it]);
+  }
+
+  void calculate_states(int stage_it, int first_state, int last_state, std::size_t worker)
+  {
+    const TraceSpan span("stage", "stage", stage_it, "states", last_state - first_state + 1);
+    StageCounters counters;
+    const StageTimer timer;
+    if (engine == Engine::forward)
+      calculate_forward_stage(stage_it, first_state, last_state, counters);
+    else if (kernel == Kernel::sliding_window && engine != Engine::table)
+      calculate_stage_sliding_window(stage_it, first_state, last_state, worker, counters);
+    else if (kernel == Kernel::simd && engine != Engine::table && stage_it > 0)
+      calculate_stage_simd(stage_it, first_state, last_state, counters);
+    else
+      calculate_stage_scalar(stage_it, first_state, last_state, counters);
+
+    if constexpr (instrumentation_enabled)
+    {
+      timer.stop(counters);
+      worker_stage_counters[worker * stages.stages_count + stage_it] += counters;
+    }
+  }
+
+  // States of the row a stage reads: the previous stage's, or the single
+  // empty-store state before stage 0.
+  int input_first_state(int stage) const
+  {
+    return stage > 0 ? stages.first_states[stage - 1] : 0;
+  }
+
+  std::size_t input_width(int stage) const
+  {
+    return stage > 0 ? stages.row_width(stage - 1) : 1;
+  }
+
+  // Multiplies the banded transforms of the product's stages one by one,
+  // starting from the identity on its input states. Each stage widens a
+  // row's finite columns by at most P + 1, so only those are visited.
+  void multiply_stage_transforms(TransformProduct &product) const
+  {
+    const std::size_t columns_count = input_width(product.first_stage);
+    std::size_t rows_count = columns_count;
+    for (int stage = product.first_stage; stage <= product.last_stage; ++stage)
+      rows_count = std::max(rows_count, stages.row_width(stage));
+
+    std::vector<Cost> &current = product.costs;
+    std::vector<Cost> &next = product.partial_costs;
+    auto &current_ranges = product.column_ranges;
+    auto &next_ranges = product.partial_column_ranges;
+    current.reserve(rows_count * columns_count);
+    next.reserve(rows_count * columns_count);
+    current_ranges.reserve(rows_count);
+    next_ranges.reserve(rows_count);
+    current.assign(columns_count * columns_count, infeasible_cost);
+    current_ranges.resize(columns_count);
+    for (std::size_t column = 0; column < columns_count; ++column)
+    {
+      current[column * columns_count + column] = 0;
+      current_ranges[column] = {column, column + 1};
+    }
+
+    for (int stage = product.first_stage; stage <= product.last_stage; ++stage)
+    {
+      const int first_state = stages.first_states[stage];
+      const int previous_first = input_first_state(stage);
+      const int previous_last = previous_first + int(input_width(stage)) - 1;
+      const int demand = reversed_requests[stage];
+      const int last_state = std::size_t(stage) + 1 == reversed_requests.size() ? std::min(stages.last_states[stage], 0) : stages.last_states[stage];
+
+      next.assign(stages.row_width(stage) * columns_count, infeasible_cost);
+      next_ranges.assign(stages.row_width(stage), {columns_count, 0});
+      for (int state = first_state; state <= last_state; ++state)
+      {
+        Cost *target = next.data() + (state - first_state) * columns_count;
+        auto &target_range = next_ranges[state - first_state];
+        for (int x = 0; x <= int(production_capacity); ++x)
+        {
+          const int to_store = state + x - demand;
+          if (to_store < previous_first || to_store > previous_last)
+            continue;
+
+          const Cost step_cost = (x > 0 ? constant_production_cost : 0) + store_cost * state;
+          const Cost *source = current.data() + (to_store - previous_first) * columns_count;
+          const auto [first_column, last_column] = current_ranges[to_store - previous_first];
+          for (std::size_t column = first_column; column < last_column; ++column)
+          {
+            if (source[column] != infeasible_cost)
+              target[column] = std::min<Cost>(target[column], source[column] + step_cost);
+          }
+          if (first_column < last_column)
+          {
+            target_range.first = std::min(target_range.first, first_column);
+            target_range.second = std::max(target_range.second, last_column);
+          }
+        }
+      }
+      current.swap(next);
+      current_ranges.swap(next_ranges);
+    }
+
+    product.rows_count = stages.row_width(product.last_stage);
+    product.columns_count = columns_count;
+  }
+
+  // Sends the cost row entering each node of a level down to its children:
+  // the left child gets it as is, the right child after the left child's
+  // product.
+  void distribute_inputs(std::size_t level)
+  {
+    auto &parents = product_levels[level];
+    auto &children = product_levels[level - 1];
+    for (std::size_t node = 0; node < level_sizes[level]; ++node)
+    {
+      TransformProduct &left = children[2 * node];
+      left.input.reserve(stages.states_count);
+      left.input = parents[node].input;
+      if (2 * node + 1 < level_sizes[level - 1])
+      {
+        TransformProduct &right = children[2 * node + 1];
+        right.input.reserve(stages.states_count);
+        right.input.resize(left.rows_count);
+        min_plus_apply(left.costs.data(), left.input.data(), right.input.data(), left.rows_count, left.columns_count,
+                       infeasible_cost);
+      }
+    }
+  }
+
+  // Whether sharing the transform products among workers_count workers
+  // beats one plain pass over the stages, which costs N * S * (P + 1). The
+  // blocks cost up to S times that, every inner node of the tree S^3, and
+  // the final pass over the blocks another plain pass.
+  bool min_plus_pays_off(std::size_t workers_count, int blocks_count) const
+  {
+    const double states_count = stages.states_count;
+    const double plain_work = double(reversed_requests.size()) * states_count * (production_capacity + 1);
+    const double products_work = plain_work * states_count + (blocks_count - 1) * states_count * states_count * states_count;
+    return products_work < (workers_count - 1.0) * plain_work;
+  }
+
+  // The horizon is cut into blocks whose transform products are combined
+  // pairwise, level by level, in parallel. Walking the tree back down with
+  // the stored left products gives the cost row entering every block, after
+  // which the blocks compute their own cost and decision rows concurrently.
+  // Unless min_plus_pays_off, this returns false and the stages are
+  // calculated one by one instead; so does running on an external executor,
+  // whose workers are busy with other jobs.
+  bool calculate_stages_min_plus()
+  {
+    if (!parallel || executor || parallel->size() <= 1)
+      return false;
+
+    const int stages_count = reversed_requests.size();
+    const std::size_t workers_count = parallel->size();
+    // Every block after the first spans at least two stages, so the last
+    // stage of a block never reads the row the previous block rewrites
+    // concurrently in the final pass.
+    const int blocks_count = std::min<int>((stages_count + 1) / 2, 4 * workers_count);
+    if (!min_plus_pays_off(workers_count, blocks_count))
+      return false;
+    auto parallel_for = [&](int count, const ParallelFor::Task &task)
+    {
+      parallel->parallel_for(0, count - 1, 1, task);
+    };
+
+    std::size_t levels_count = 1;
+    for (int nodes_count = blocks_count; nodes_count > 1; nodes_count = (nodes_count + 1) / 2)
+      ++levels_count;
+    level_sizes.resize(levels_count);
+    if (product_levels.size() < levels_count)
+      product_levels.resize(levels_count);
+    for (std::size_t level = 0; level < levels_count; ++level)
+    {
+      level_sizes[level] = level > 0 ? (level_sizes[level - 1] + 1) / 2 : blocks_count;
+      if (product_levels[level].size() < level_sizes[level])
+        product_levels[level].resize(level_sizes[level]);
+    }
+
+    for (int block = 0; block < blocks_count; ++block)
+    {
+      product_levels[0][block].first_stage = std::size_t(stages_count) * block / blocks_count;
+      product_levels[0][block].last_stage = std::size_t(stages_count) * (block + 1) / blocks_count - 1;
+    }
+    parallel_for(blocks_count, [&](std::size_t, int first_block, int last_block)
+                 {
+      for (int block = first_block; block <= last_block; ++block)
+      {
+        const TraceSpan span("multiply_block", "block", block);
+        multiply_stage_transforms(product_levels[0][block]);
+      } });
+
+    for (std::size_t level = 1; level < levels_count; ++level)
+    {
+      parallel_for(level_sizes[level], [this, level](std::size_t, int first_node, int last_node)
+                   {
+        const TraceSpan span("multiply_level", "level", level, "nodes", last_node - first_node + 1);
+        const auto &children = product_levels[level - 1];
+        auto &parents = product_levels[level];
+        const std::size_t children_count = level_sizes[level - 1];
+        for (int node = first_node; node <= last_node; ++node)
+        {
+          const TransformProduct &left = children[2 * node];
+          TransformProduct &parent = parents[node];
+          if (std::size_t(2 * node + 1) == children_count)
+          {
+            parent.first_stage = left.first_stage;
+            parent.last_stage = left.last_stage;
+            parent.rows_count = left.rows_count;
+            parent.columns_count = left.columns_count;
+            parent.costs = left.costs;
+            continue;
+          }
+
+          const TransformProduct &right = children[2 * node + 1];
+          parent.first_stage = left.first_stage;
+          parent.last_stage = right.last_stage;
+          parent.rows_count = right.rows_count;
+          parent.columns_count = left.columns_count;
+          parent.costs.resize(parent.rows_count * parent.columns_count);
+          min_plus_multiply(right.costs.data(), left.costs.data(), parent.costs.data(), right.rows_count,
+                            right.columns_count, left.columns_count, infeasible_cost);
+        } });
+    }
+
+    if (blocks_count > 0)
+    {
+      const TraceSpan span("distribute_inputs", "levels", levels_count);
+      product_levels[levels_count - 1][0].input.assign(1, 0);
+      for (std::size_t level = levels_count - 1; level > 0; --level)
+        distribute_inputs(level);
+    }
+
+    // A block's last row is the next block's input, so it is written in a
+    // second pass after every block has read its input.
+    for (int block = 1; block < blocks_count; ++block)
+    {
+      const TransformProduct &product = product_levels[0][block];
+      std::copy(product.input.begin(), product.input.end(), stages.cost_row(product.first_stage - 1));
+    }
+    parallel_for(blocks_count, [&](std::size_t worker, int first_block, int last_block)
+                 {
+      for (int block = first_block; block <= last_block; ++block)
+      {
+        for (int stage = product_levels[0][block].first_stage; stage < product_levels[0][block].last_stage; ++stage)
+        {
+          if (stages.row_width(stage) > 0)
+            calculate_states(stage, stages.first_states[stage], stages.last_states[stage], worker);
+        }
+      } });
+    parallel_for(blocks_count, [&](std::size_t worker, int first_block, int last_block)
+                 {
+      for (int block = first_block; block <= last_block; ++block)
+      {
+        const int stage = product_levels[0][block].last_stage;
+        if (stages.row_width(stage) > 0)
+          calculate_states(stage, stages.first_states[stage], stages.last_states[stage], worker);
+      } });
+    return true;
+  }
+
+  int segment_first_stage(int segment) const
+  {
+    return segment > 0 ? regeneration_stages[segment - 1] + 1 : 0;
+  }
+
+  int segment_last_stage(int segment) const
+  {
+    return segment < int(regeneration_stages.size()) ? regeneration_stages[segment] : int(stages.stages_count) - 1;
+  }
+
+  void calculate_row(int stage, std::size_t worker)
+  {
+    if (stages.row_width(stage) > 0)
+      calculate_states(stage, stages.first_states[stage], stages.last_states[stage], worker);
+  }
+
+  // A stage whose only state is the empty store is a regeneration point: the
+  // stages after it read it as a single cost, so an optimal plan of the
+  // periods on either side does not depend on the other side. With a thread
+  // pool, engines that keep every row solve the segments between such stages
+  // concurrently as if the cost they read were zero, then shift each segment
+  // by the true cost of the regeneration point before it. Returns false when
+  // the stages are to be calculated one by one instead.
+  bool calculate_segments()
+  {
+    if (!split_segments || !parallel || (engine != Engine::table && engine != Engine::forward))
+      return false;
+
+    const int stages_count = stages.stages_count;
+    // Segments after the first keep at least two stages, so none reads a
+    // row that is calculated in the same pass.
+    regeneration_stages.clear();
+    regeneration_stages.reserve(stages_count);
+    segment_offsets.reserve(stages_count);
+    for (int stage = 0; stage + 2 < stages_count; ++stage)
+    {
+      const bool is_regeneration = stages.first_states[stage] == 0 && stages.last_states[stage] == 0;
+      if (is_regeneration && (regeneration_stages.empty() || stage > regeneration_stages.back() + 1))
+        regeneration_stages.push_back(stage);
+    }
+    if (regeneration_stages.empty())
+      return false;
+
+    const int segments_count = regeneration_stages.size() + 1;
+
+    // The last stage of a segment is the zero cost the next segment reads, so
+    // it is only calculated once every segment has read it.
+    for (const int stage : regeneration_stages)
+      stages.cost_row(stage)[0] = 0;
+    parallel->parallel_for(0, segments_count - 1, 1, [this](std::size_t worker, int first_segment, int last_segment)
+                           {
+      for (int segment = first_segment; segment <= last_segment; ++segment)
+      {
+        for (int stage = segment_first_stage(segment); stage < segment_last_stage(segment); ++stage)
+          calculate_row(stage, worker);
+      } });
+    parallel->parallel_for(0, segments_count - 1, 1, [this](std::size_t worker, int first_segment, int last_segment)
+                           {
+      for (int segment = first_segment; segment <= last_segment; ++segment)
+        calculate_row(segment_last_stage(segment), worker); });
+
+    segment_offsets.assign(segments_count, 0);
+    for (int segment = 1; segment < segments_count; ++segment)
+    {
+      const Cost offset = segment_offsets[segment - 1];
+      const Cost cost = stages.cost_row(regeneration_stages[segment - 1])[0];
+      segment_offsets[segment] = offset == infeasible_cost || cost == infeasible_cost ? infeasible_cost : offset + cost;
+    }
+
+    parallel->parallel_for(1, segments_count - 1, 1, [this](std::size_t, int first_segment, int last_segment)
+                           {
+      for (int segment = first_segment; segment <= last_segment; ++segment)
+      {
+        const Cost offset = segment_offsets[segment];
+        for (int stage = segment_first_stage(segment); stage <= segment_last_stage(segment); ++stage)
+        {
+          Cost *costs = stages.cost_row(stage);
+          int *optimal_decisions = stages.decision_row(stage);
+          for (std::size_t state = 0; state < stages.row_width(stage); ++state)
+          {
+            if (offset == infeasible_cost)
+            {
+              costs[state] = infeasible_cost;
+              optimal_decisions[state] = no_decision;
+            }
+            else if (costs[state] != infeasible_cost)
+              costs[state] += offset;
+          }
+
+          if (stages.decisions_count == 0 || stages.row_width(stage) == 0)
+            continue;
+          Cost *decision_costs = stages.decisions(stage, stages.first_states[stage]);
+          for (std::size_t decision = 0; decision < stages.row_width(stage) * stages.decisions_count; ++decision)
+          {
+            if (offset == infeasible_cost)
+              decision_costs[decision] = infeasible_cost;
+            else if (decision_costs[decision] != infeasible_cost)
+              decision_costs[decision] += offset;
+          }
+        }
+      } });
+    return true;
+  }
+
+  // For a state s > 0 units of production reach the next-stage states
+  // [s + 1 - demand, s + P - demand], a window that only moves forward as s
+  // grows, so the cheapest of them is kept at the front of a queue ordered by
+  // cost. Equal costs keep the earlier (smaller) state, which preserves the
+  // scalar kernel's preference for the smallest production quantity.
+  void calculate_stage_sliding_window(int stage_it, int first_chunk_state, int last_chunk_state, std::size_t worker,
+                                      StageCounters &counters)
+  {
+    const Cost *previous_costs = stage_it > 0 ? stages.cost_row(stage_it - 1) : nullptr;
+    const int first_state = stages.first_states[stage_it];
+    Cost *costs = stages.cost_row(stage_it);
+    int *optimal_decisions = stages.decision_row(stage_it);
+    const int demand = reversed_requests[stage_it];
+    const int last_state = std::size_t(stage_it) + 1 == reversed_requests.size() ? std::min(last_chunk_state, 0) : last_chunk_state;
+
+    std::fill(costs + (first_chunk_state - first_state), costs + (last_chunk_state - first_state + 1), infeasible_cost);
+    std::fill(optimal_decisions + (first_chunk_state - first_state), optimal_decisions + (last_chunk_state - first_state + 1), no_decision);
+
+    if (stage_it == 0)
+    {
+      for (int state = first_chunk_state; state <= last_state && state <= demand; ++state)
+      {
+        counters.visit_state();
+        const int x = demand - state;
+        if (x > int(production_capacity))
+        {
+          counters.skip(SkipReason::over_capacity);
+          continue;
+        }
+
+        counters.evaluate();
+        costs[state - first_state] = (x > 0 ? constant_production_cost : 0) + store_cost * state;
+        optimal_decisions[state - first_state] = x;
+      }
+      return;
+    }
+
+    const int previous_first = stages.first_states[stage_it - 1];
+    const int previous_last = stages.last_states[stage_it - 1];
+    int *window = window_states.data() + worker * stages.states_count;
+    std::size_t window_front = 0;
+    std::size_t window_back = 0;
+    int next_to_store = std::max(previous_first, first_chunk_state + 1 - demand);
+
+    for (int state = first_chunk_state; state <= last_state; ++state)
+    {
+      counters.visit_state();
+      const int first_to_store = state + 1 - demand;
+      const int last_to_store = std::min<int>(state + production_capacity - demand, previous_last);
+
+      for (; next_to_store <= last_to_store; ++next_to_store)
+      {
+        const Cost cost = previous_costs[next_to_store - previous_first];
+        if (cost == infeasible_cost)
+        {
+          counters.skip(SkipReason::infeasible_state);
+          continue;
+        }
+
+        counters.evaluate();
+        while (window_back > window_front && previous_costs[window[window_back - 1] - previous_first] > cost)
+          --window_back;
+        window[window_back++] = next_to_store;
+      }
+
+      while (window_back > window_front && window[window_front] < first_to_store)
+        ++window_front;
+
+      Cost optimal_cost = infeasible_cost;
+      int optimal_decision = no_decision;
+
+      const int idle_to_store = state - demand;
+      if (previous_first <= idle_to_store && idle_to_store <= previous_last)
+      {
+        if (previous_costs[idle_to_store - previous_first] != infeasible_cost)
+        {
+          counters.evaluate();
+          optimal_cost = previous_costs[idle_to_store - previous_first];
+          optimal_decision = 0;
+        }
+        else
+          counters.skip(SkipReason::infeasible_state);
+      }
+
+      if (window_back > window_front)
+      {
+        const int to_store = window[window_front];
+        const Cost total_cost = constant_production_cost + previous_costs[to_store - previous_first];
+        if (optimal_cost > total_cost)
+        {
+          optimal_cost = total_cost;
+          optimal_decision = to_store - state + demand;
+        }
+      }
+
+      if (optimal_decision == no_decision)
+        continue;
+
+      costs[state - first_state] = optimal_cost + store_cost * state;
+      optimal_decisions[state - first_state] = optimal_decision;
+    }
+  }
+
+  // Positive production quantities x in [first_x, last_x] reach the
+  // contiguous previous-stage states state + x - demand and share the
+  // constant production cost, so their minimum is one argmin over a slice of
+  // the previous cost row. Infeasible states hold infeasible_cost and lose
+  // every comparison, and the first minimum is the smallest production
+  // quantity, as in the scalar kernel.
+  void calculate_stage_simd(int stage_it, int first_chunk_state, int last_chunk_state, StageCounters &counters)
+  {
+    const Cost *previous_costs = stages.cost_row(stage_it - 1);
+    const int previous_first = stages.first_states[stage_it - 1];
+    const int previous_last = stages.last_states[stage_it - 1];
+    const int first_state = stages.first_states[stage_it];
+    Cost *costs = stages.cost_row(stage_it);
+    int *optimal_decisions = stages.decision_row(stage_it);
+    const int demand = reversed_requests[stage_it];
+    const bool last_stage = std::size_t(stage_it) + 1 == reversed_requests.size();
+
+    for (int state = first_chunk_state; state <= last_chunk_state; ++state)
+    {
+      counters.visit_state();
+      Cost optimal_cost = infeasible_cost;
+      int optimal_decision = no_decision;
+
+      const int idle_to_store = state - demand;
+      if (previous_first <= idle_to_store && idle_to_store <= previous_last)
+      {
+        if (previous_costs[idle_to_store - previous_first] != infeasible_cost)
+        {
+          counters.evaluate();
+          optimal_cost = previous_costs[idle_to_store - previous_first];
+          optimal_decision = 0;
+        }
+        else
+          counters.skip(SkipReason::infeasible_state);
+      }
+
+      const int first_x = std::max(1, previous_first - idle_to_store);
+      const int last_x = std::min<int>(production_capacity, previous_last - idle_to_store);
+      if (first_x <= last_x)
+      {
+        counters.evaluate(last_x - first_x + 1);
+        const Cost *candidates = previous_costs + (idle_to_store + first_x - previous_first);
+        const int best = argmin(candidates, last_x - first_x + 1);
+        if (candidates[best] != infeasible_cost && optimal_cost > constant_production_cost + candidates[best])
+        {
+          optimal_cost = constant_production_cost + candidates[best];
+          optimal_decision = first_x + best;
+        }
+      }
+
+      if (last_stage && state > 0)
+        optimal_decision = no_decision;
+
+      costs[state - first_state] = optimal_decision == no_decision ? infeasible_cost : optimal_cost + store_cost * state;
+      optimal_decisions[state - first_state] = optimal_decision;
+    }
+  }
+
+  void calculate_stage_scalar(int stage_it, int first_chunk_state, int last_chunk_state, StageCounters &counters)
+  {
+    const Cost *previous_costs = stage_it > 0 ? stages.cost_row(stage_it - 1) : nullptr;
+    const int previous_first = stage_it > 0 ? stages.first_states[stage_it - 1] : 0;
+    const int previous_last = stage_it > 0 ? stages.last_states[stage_it - 1] : 0;
+    const int first_state = stages.first_states[stage_it];
+    Cost *costs = stages.cost_row(stage_it);
+    int *optimal_decisions = stages.decision_row(stage_it);
+
+    for (int state = first_chunk_state; state <= last_chunk_state; ++state)
+    {
+      counters.visit_state();
+      Cost optimal_cost = infeasible_cost;
+      int optimal_decision = no_decision;
+      Cost *decisions = stages.decisions(stage_it, state);
+
+      for (int x = 0; x <= int(production_capacity); ++x)
+      {
+        int total_supply = state + x;
+
+        // Last stage
+        if (std::size_t(stage_it) + 1 == reversed_requests.size() && state > 0)
+        {
+          counters.skip(SkipReason::last_stage_state);
+          continue;
+        }
+
+        // Initial stage
+        if (stage_it == 0 && total_supply != reversed_requests[stage_it])
+        {
+          counters.skip(SkipReason::first_stage_supply);
+          continue;
+        }
+
+        if (total_supply < reversed_requests[stage_it])
+        {
+          counters.skip(SkipReason::short_supply);
+          continue;
+        }
+
+        int to_store = total_supply - reversed_requests[stage_it];
+        if (to_store < previous_first || to_store > previous_last)
+        {
+          counters.skip(SkipReason::outside_states);
+          continue;
+        }
+
+        if (stage_it > 0 && previous_costs[to_store - previous_first] == infeasible_cost)
+        {
+          counters.skip(SkipReason::infeasible_state);
+          continue;
+        }
+
+        counters.evaluate();
+        Cost production_cost = x > 0 ? constant_production_cost : 0;
+        Cost current_store_cost = store_cost * state;
+        Cost total_cost = production_cost + current_store_cost;
+
+        if (stage_it > 0)
+          total_cost += previous_costs[to_store - previous_first];
+
+        if (decisions)
+          decisions[x] = total_cost;
+        if (optimal_cost > total_cost)
+        {
+          optimal_cost = total_cost;
+          optimal_decision = x;
+        }
+      }
+
+      costs[state - first_state] = optimal_cost;
+      optimal_decisions[state - first_state] = optimal_decision;
+    }
+  }
+
+  // calculate_stages from first_stage on, without any output.
+  void calculate_stages_quietly(std::size_t first_stage = 0)
+  {
+    reset_stage_counters();
+    if (uncapacitated)
+    {
+      calculate_lot_sizing();
+      return;
+    }
+    if (small_capacity_solver)
+    {
+      calculate_small_capacities();
+      return;
+    }
+
+    for (std::size_t stage = first_stage; stage < stages.stages_count; ++stage)
+    {
+      calculate_stage(stage);
+      save_checkpoint(stage);
+    }
+    if (stages.stages_count > 0)
+      optimal_plan_cost = stages.optimal_cost(stages.stages_count - 1, 0);
+  }
+
+  // Lays out the stages, buffers and thread pool for the current parameters
+  // and requests.
+  void init_instance()
+  {
+    uncapacitated = uses_lot_sizing();
+    small_capacity_solver = nullptr;
+    if (!uncapacitated && specialize_small_capacities && engine != Engine::forward && output != Output::full &&
+        !requests.empty())
+      small_capacity_solver = select_small_capacity_solver<Cost>(production_capacity, store_capacity);
+    if (uncapacitated || small_capacity_solver)
+    {
+      stages.stages_count = 0;
+      stages.first_states.clear();
+      stages.last_states.clear();
+    }
+    else
+    {
+      Options options;
+      options.engine = engine;
+      options.prune_states = prune_states;
+      const TraceSpan span("init_stages", "periods", requests.size());
+      init_stages(stages, options, production_capacity, store_capacity, requests);
+    }
+
+    // An empty horizon has no stages to set it: its empty plan costs nothing.
+    optimal_plan_cost = requests.empty() ? static_cast<Cost>(0) : infeasible_cost;
+    lot_sizing_decisions.clear();
+    plan_decisions.clear();
+    plan_total_cost = 0;
+
+    if (executor || threads_count <= 1)
+      thread_pool.reset();
+    else if (!uncapacitated && !small_capacity_solver && (!thread_pool || thread_pool->size() != threads_count))
+    {
+      // Workers open their hardware counters as they start, so a stage timer
+      // never allocates them in a later solve.
+      std::function<void()> start_worker;
+      if constexpr (instrumentation_enabled)
+        start_worker = []
+        { thread_perf_counters(); };
+      thread_pool = std::make_unique<ThreadPool>(threads_count, start_worker);
+    }
+    parallel = executor ? executor : thread_pool.get();
+    if (kernel == Kernel::sliding_window)
+      window_states.resize(threads_count * (store_capacity + 1));
+
+    count_skipped_states();
+  }
+
+  // Clears the counters of every stage of every worker before the stages are
+  // calculated.
+  void reset_stage_counters()
+  {
+    if constexpr (instrumentation_enabled)
+      worker_stage_counters.assign((parallel ? parallel->size() : 1) * stages.stages_count, StageCounters());
+  }
+
+  void count_skipped_states()
+  {
+    skipped_states = 0;
+    for (std::size_t stage = 0; stage < stages.stages_count; ++stage)
+      skipped_states += stages.states_count - stages.row_width(stage);
+  }
+
+  // Bounds the states again after the demand of changed_stage changed and
+  // returns the first stage to recompute. The rows of the stages before it
+  // keep both their states and their place in the arrays; the rest are moved
+  // and cleared.
+  std::size_t update_state_bounds(std::size_t changed_stage)
+  {
+    if (engine == Engine::forward)
+      init_forward_state_bounds(updated_first_states, updated_last_states, prune_states, production_capacity,
+                                store_capacity, requests);
+    else
+      init_state_bounds(updated_first_states, updated_last_states, prune_states, production_capacity, store_capacity,
+                        requests);
+
+    std::size_t first_stage = 0;
+    while (first_stage < changed_stage && updated_first_states[first_stage] == stages.first_states[first_stage] &&
+           updated_last_states[first_stage] == stages.last_states[first_stage])
+      ++first_stage;
+
+    std::copy(updated_first_states.begin() + first_stage, updated_first_states.end(), stages.first_states.begin() + first_stage);
+    std::copy(updated_last_states.begin() + first_stage, updated_last_states.end(), stages.last_states.begin() + first_stage);
+    init_row_offsets(stages, first_stage);
+    count_skipped_states();
+
+    stages.optimal_costs.resize(stages.rows_size(stages.cost_rows_count), infeasible_cost);
+    stages.optimal_decisions.resize(stages.rows_size(stages.decision_rows_count), no_decision);
+    if (stages.decisions_count > 0)
+    {
+      stages.decision_costs.resize(stages.rows_size(stages.stages_count) * stages.decisions_count);
+      std::fill(stages.decision_costs.begin() + stages.row_offsets[first_stage] * stages.decisions_count,
+                stages.decision_costs.end(), infeasible_cost);
+    }
+    return first_stage;
+  }
+
+  // The cheapest cost of periods 0..t leaving each state in the store, with the
+  // production of period t as its decision. The entering inventory
+  // state + demand - x must be a state of the previous stage, and holding is
+  // charged on it as in the backward stages.
+  void calculate_forward_stage(int stage_it, int first_chunk_state, int last_chunk_state, StageCounters &counters)
+  {
+    const Cost *previous_costs = stage_it > 0 ? stages.cost_row(stage_it - 1) : nullptr;
+    const int previous_first = stage_it > 0 ? stages.first_states[stage_it - 1] : 0;
+    const int previous_last = stage_it > 0 ? stages.last_states[stage_it - 1] : 0;
+    const int first_state = stages.first_states[stage_it];
+    Cost *costs = stages.cost_row(stage_it);
+    int *optimal_decisions = stages.decision_row(stage_it);
+    const int demand = requests[stage_it];
+
+    for (int state = first_chunk_state; state <= last_chunk_state; ++state)
+    {
+      counters.visit_state();
+      Cost optimal_cost = infeasible_cost;
+      int optimal_decision = no_decision;
+
+      const int first_x = std::max(state + demand - previous_last, 0);
+      const int last_x = std::min<int>(state + demand - previous_first, production_capacity);
+      for (int x = first_x; x <= last_x; ++x)
+      {
+        const int previous_state = state + demand - x;
+        const Cost previous_cost = stage_it > 0 ? previous_costs[previous_state - previous_first] : 0;
+        if (previous_cost == infeasible_cost)
+        {
+          counters.skip(SkipReason::infeasible_state);
+          continue;
+        }
+
+        counters.evaluate();
+
+        const Cost total_cost = previous_cost + store_cost * previous_state + (x > 0 ? constant_production_cost : 0);
+        if (optimal_cost > total_cost)
+        {
+          optimal_cost = total_cost;
+          optimal_decision = x;
+        }
+      }
+
+      costs[state - first_state] = optimal_cost;
+      optimal_decisions[state - first_state] = optimal_decision;
+    }
+  }
+
+  // Walks the forward stages back from the empty store after the last period.
+  bool trace_forward_decisions()
+  {
+    plan_decisions.resize(stages.stages_count);
+    int state = 0;
+    for (int stage = int(stages.stages_count) - 1; stage >= 0; --stage)
+    {
+      const int optimal_decision = stages.optimal_decision(stage, state);
+      if (optimal_decision == no_decision)
+        return false;
+
+      plan_decisions[stage] = optimal_decision;
+      state += requests[stage] - optimal_decision;
+    }
+    return true;
+  }
+
+  bool trace_backward_decisions()
+  {
+    plan_decisions.assign(lot_sizing_decisions.begin(), lot_sizing_decisions.end());
+    std::size_t used_store_space = 0;
+    for (int stage_index = stages.stages_count - 1; stage_index >= 0; stage_index--)
+    {
+      if (engine == Engine::checkpoint && is_segment_end(stage_index))
+        restore_segment(stage_index);
+
+      const int optimal_decision = stages.optimal_decision(stage_index, used_store_space);
+      if (optimal_decision == no_decision)
+        return false;
+
+      plan_decisions.emplace_back(optimal_decision);
+      if (stage_index > 0)
+        used_store_space += optimal_decision - reversed_requests[stage_index];
+    }
+    return true;
+  }
+
+public:
+  // Follows the optimal decisions from the first period into decisions() and
+  // total_cost(); returns false when the instance has no feasible plan.
+  bool trace_plan()
+  {
+    const TraceSpan span("trace_plan");
+    bool found = false;
+    if (small_capacity_solver)
+      found = trace_small_capacity_decisions();
+    else
+      found = engine == Engine::forward ? trace_forward_decisions() : trace_backward_decisions();
+    if (!found)
+    {
+      plan_decisions.clear();
+      return false;
+    }
+
+    if (optimal_plan_cost < static_cast<Cost>(0))
+      throw std::overflow_error("Negative plan cost");
+    plan_total_cost = static_cast<long long>(optimal_plan_cost);
+    for (auto &&request : requests)
+    {
+      std::size_t request_cost;
+      if (__builtin_mul_overflow(good_production_cost, std::size_t(request), &request_cost) ||
+          __builtin_add_overflow(plan_total_cost, request_cost, &plan_total_cost))
+        throw std::overflow_error("Total cost overflow");
+    }
+    return true;
+  }
+
+  void trace_stages()
+  {
+    const TraceSpan span("trace_stages");
+    const bool found = trace_plan();
+    if (output == Output::none)
+      return;
+
+    if (!found)
+      std::cout << "No solution found!" << std::endl;
+    else
+    {
+      std::cout << "Optimal decisions:" << std::endl;
+      for (auto iterator = plan_decisions.begin(); iterator < plan_decisions.end(); iterator++)
+        std::cout << "x" << (iterator - plan_decisions.begin()) << ": " << (*iterator) << std::endl;
+
+      std::cout << "Total cost: " << plan_total_cost << std::endl;
+    }
+
+    if constexpr (instrumentation_enabled)
+    {
+      std::cout << "Stage counters: ";
+      write_stage_counters(std::cout);
+      std::cout << std::endl;
+    }
+  }
+
+  // Counters of every stage, summed over the workers, since the last
+  // calculate_stages, update_request or append_request (including the
+  // segments the checkpoint engine recomputes while tracing). Indexed like
+  // the stages: stage t is period t for the forward engine and period
+  // N - 1 - t otherwise. Empty unless built with DP_INSTRUMENTATION, and for
+  // instances solved by lot sizing or the small capacity solvers, which have
+  // no stages.
+  std::vector<StageCounters> stage_counters() const
+  {
+    std::vector<StageCounters> counters(worker_stage_counters.empty() ? 0 : stages.stages_count);
+    for (std::size_t index = 0; index < worker_stage_counters.size(); ++index)
+      counters[index % stages.stages_count] += worker_stage_counters[index];
+    return counters;
+  }
+
+  // Writes stage_counters() as a JSON object with the solver that ran, one
+  // entry per stage and their total, and why the hardware events are missing
+  // when the calling thread cannot count them.
+  void write_stage_counters(std::ostream &output) const
+  {
+    const char *solver = uncapacitated ? "lot_sizing" : small_capacity_solver ? "small_capacity" : "stages";
+    output << "{\"solver\": \"" << solver << "\", ";
+    if (!thread_perf_counters().available())
+      output << "\"perf_unavailable\": \"" << thread_perf_counters().why_unavailable() << "\", ";
+    output << "\"stages\": [";
+    const std::vector<StageCounters> counters = stage_counters();
+    StageCounters total;
+    for (std::size_t stage = 0; stage < counters.size(); ++stage)
+    {
+      const std::size_t period = engine == Engine::forward ? stage : counters.size() - 1 - stage;
+      output << (stage > 0 ? ", " : "") << "{\"stage\": " << stage << ", \"period\": " << period << ", ";
+      write_counters_json(output, counters[stage]);
+      output << "}";
+      total += counters[stage];
+    }
+    output << "], \"total\": {";
+    write_counters_json(output, total);
+    output << "}}";
+  }
+
+  // Production quantity of every period in the plan found by trace_plan.
+  const std::vector<int> &decisions() const
+  {
+    return plan_decisions;
+  }
+
+  std::size_t total_cost() const
+  {
+    return plan_total_cost;
+  }
+
+  BasicDpProductionPlanner() = default;
+
+  BasicDpProductionPlanner(const std::size_t i_production_capacity,
+                           const std::size_t i_store_capacity,
+                           const std::size_t i_store_cost,
+                           const std::size_t i_constant_production_cost,
+                           const std::size_t i_good_production_cost,
+                           const std::vector<int> &i_requests,
+                           const Options &i_options)
+  {
+    reset(i_production_capacity, i_store_capacity, i_store_cost, i_constant_production_cost, i_good_production_cost,
+          i_requests, i_options);
+  }
+
+  BasicDpProductionPlanner(const std::size_t i_production_capacity,
+                           const std::size_t i_store_capacity,
+                           const std::size_t i_store_cost,
+                           const std::size_t i_constant_production_cost,
+                           const std::size_t i_good_production_cost,
+                           const std::vector<int> &i_requests) : BasicDpProductionPlanner(i_production_capacity,
+                                                                                          i_store_capacity,
+                                                                                          i_store_cost,
+                                                                                          i_constant_production_cost,
+                                                                                          i_good_production_cost,
+                                                                                          i_requests,
+                                                                                          Options())
+  {
+  }
+
+  // Prepares the planner for another instance. Stage storage, buffers and the
+  // thread pool of the previous instance are reused, so once a planner has
+  // seen its largest instance, reset, calculate_stages and trace_plan no
+  // longer allocate (for the same engine, kernel and thread count).
+  void reset(const std::size_t i_production_capacity,
+             const std::size_t i_store_capacity,
+             const std::size_t i_store_cost,
+             const std::size_t i_constant_production_cost,
+             const std::size_t i_good_production_cost,
+             const int *i_requests,
+             const std::size_t i_requests_count,
+             const Options &i_options)
+  {
+    engine = i_options.engine;
+    kernel = i_options.kernel;
+    output = i_options.output;
+    prune_states = i_options.prune_states;
+    lot_sizing = i_options.lot_sizing;
+    specialize_small_capacities = i_options.specialize_small_capacities;
+    split_segments = i_options.split_segments;
+    executor = i_options.executor;
+    if (executor)
+      threads_count = executor->size();
+    else
+      threads_count = i_options.threads > 0 ? i_options.threads : std::max(std::thread::hardware_concurrency(), 1U);
+    production_capacity = i_production_capacity;
+    store_capacity = i_store_capacity;
+    store_cost = to_cost(i_store_cost);
+    constant_production_cost = to_cost(i_constant_production_cost);
+    good_production_cost = i_good_production_cost;
+    check_cost_bound(i_requests_count);
+
+    requests.assign(i_requests, i_requests + i_requests_count);
+    if (engine == Engine::forward)
+      reversed_requests.clear();
+    else
+      reversed_requests.assign(requests.rbegin(), requests.rend());
+    init_instance();
+  }
+
+  void reset(const std::size_t i_production_capacity,
+             const std::size_t i_store_capacity,
+             const std::size_t i_store_cost,
+             const std::size_t i_constant_production_cost,
+             const std::size_t i_good_production_cost,
+             const std::vector<int> &i_requests,
+             const Options &i_options)
+  {
+    reset(i_production_capacity, i_store_capacity, i_store_cost, i_constant_production_cost, i_good_production_cost,
+          i_requests.data(), i_requests.size(), i_options);
+  }
+
+  // Changes the demand of one period and re-solves the instance, returning
+  // trace_plan(). Stage t only depends on stages below it, so only the stages
+  // from the changed one on are recomputed, or from the first stage whose
+  // pruned states moved if that is earlier. The checkpoint engine restarts
+  // from the start of that stage's segment; the rolling engine, which no
+  // longer holds the earlier cost rows, instances without stage tables and
+  // those switching to or from lot sizing are solved again in full.
+  bool update_request(std::size_t period, int request)
+  {
+    if (period >= requests.size())
+      throw std::out_of_range("Period " + std::to_string(period) + " out of range");
+
+    const std::size_t changed_stage = engine == Engine::forward ? period : requests.size() - 1 - period;
+    requests[period] = request;
+    if (engine != Engine::forward)
+      reversed_requests[changed_stage] = request;
+
+    std::size_t first_stage = 0;
+    if (uncapacitated || small_capacity_solver || engine == Engine::rolling || uses_lot_sizing())
+      init_instance();
+    else
+    {
+      first_stage = update_state_bounds(changed_stage);
+      if (engine == Engine::checkpoint)
+      {
+        const std::size_t segment = first_stage / stages.checkpoint_interval;
+        first_stage = segment * stages.checkpoint_interval;
+        if (segment > 0)
+          std::copy_n(stages.checkpoint_row(segment), stages.row_width(first_stage - 1), stages.cost_row(first_stage - 1));
+      }
+    }
+
+    calculate_stages_quietly(first_stage);
+    return trace_plan();
+  }
+
+  // Adds a period at the end of the horizon. The forward engine computes just
+  // the new stage, so a rolling horizon grows in O(S * P) per period; the
+  // backward engines start from the new last period and solve again in full.
+  // Call trace_plan or trace_stages for the plan of the longer horizon.
+  void append_request(int request)
+  {
+    check_cost_bound(requests.size() + 1);
+    requests.push_back(request);
+    if (engine != Engine::forward)
+    {
+      reversed_requests.insert(reversed_requests.begin(), request);
+      init_instance();
+      calculate_stages_quietly();
+      return;
+    }
+
+    // Forward stages keep every row, laid out by row_offsets.
+    const std::size_t stage = stages.stages_count++;
+    stages.cost_rows_count = stages.stages_count;
+    stages.decision_rows_count = stages.stages_count;
+    stages.first_states.resize(stages.stages_count);
+    stages.last_states.resize(stages.stages_count);
+    bound_forward_stage(stages.first_states, stages.last_states, stage, prune_states, production_capacity,
+                        store_capacity, request);
+    stages.row_offsets.resize(stages.stages_count);
+    init_row_offsets(stages, stage);
+    stages.optimal_costs.resize(stages.rows_size(stages.cost_rows_count), infeasible_cost);
+    stages.optimal_decisions.resize(stages.rows_size(stages.decision_rows_count), no_decision);
+    skipped_states += stages.states_count - stages.row_width(stage);
+
+    reset_stage_counters();
+    calculate_stage(stage);
+    optimal_plan_cost = stages.optimal_cost(stage, 0);
+  }
+
+  // Number of (stage, state) pairs left out by state pruning.
+  std::size_t skipped_states_count() const
+  {
+    return skipped_states;
+  }
+
+  void calculate_stages()
+  {
+    const TraceSpan span("calculate_stages", "periods", requests.size());
+    reset_stage_counters();
+    if (uncapacitated)
+    {
+      calculate_lot_sizing();
+      return;
+    }
+    if (small_capacity_solver)
+    {
+      calculate_small_capacities();
+      return;
+    }
+
+    const bool calculated = engine == Engine::min_plus ? calculate_stages_min_plus() : calculate_segments();
+
+    for (std::size_t stage_it = 0; stage_it < stages.stages_count; ++stage_it)
+    {
+      if (!calculated)
+        calculate_stage(stage_it);
+
+      save_checkpoint(stage_it);
+
+      if (output == Output::full)
+      {
+        std::cout << "Stage " << (engine == Engine::forward ? stage_it + 1 : stages.stages_count - stage_it) << ":\n";
+        print_stage(stage_it);
+      }
+    }
+
+    if (output != Output::none && skipped_states > 0)
+      std::cout << "Skipped unreachable states: " << skipped_states << std::endl;
+
+    if (stages.stages_count > 0)
+      optimal_plan_cost = stages.optimal_cost(stages.stages_count - 1, 0);
+  }
+};
+
+using DpProductionPlanner = BasicDpProductionPlanner<int>;
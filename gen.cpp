@@ -0,0 +1,365 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <initializer_list>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+enum class Shape
+{
+  // A yearly cycle with noise around the mean.
+  seasonal,
+  // Intermittent orders: most periods request nothing, the rest request a
+  // lot.
+  lumpy,
+  // Noise around a mean that grows linearly from half to one and a half
+  // times the mean over the horizon.
+  trending,
+  // A low base load interrupted by short bursts of several times the mean.
+  bursty,
+  // One of the above, picked per config.
+  mixed,
+};
+
+Shape shape_from_string(const std::string &name)
+{
+  if (name == "seasonal")
+    return Shape::seasonal;
+  if (name == "lumpy")
+    return Shape::lumpy;
+  if (name == "trending")
+    return Shape::trending;
+  if (name == "bursty")
+    return Shape::bursty;
+  if (name == "mixed")
+    return Shape::mixed;
+
+  throw std::invalid_argument("Unknown shape: " + name);
+}
+
+// Returns name when it is one of names, the values the planner accepts for
+// key, so it can be written into a config without escaping.
+std::string planner_name(const std::string &key, const std::string &name, std::initializer_list<const char *> names)
+{
+  for (const char *known : names)
+  {
+    if (name == known)
+      return name;
+  }
+  throw std::invalid_argument("Unknown " + key + ": " + name);
+}
+
+struct WorkloadOptions
+{
+  Shape shape = Shape::seasonal;
+  std::size_t periods_count = 365;
+  // Configs to write as JSONL; 0 writes a single config as JSON.
+  std::size_t configs_count = 0;
+  std::uint64_t seed = 1;
+  int production_capacity = 40;
+  int store_capacity = 80;
+  int store_cost = 1;
+  int constant_cost = 50;
+  int good_cost = 2;
+  // Mean demand per period; 0 is half the production capacity.
+  double mean = 0;
+  // Periods per seasonal cycle.
+  int season_length = 52;
+  // Optional planner keys copied into every config.
+  std::string engine;
+  std::string kernel;
+  std::string cost_type;
+};
+
+// The standard library's distributions are implementation-defined, so the
+// generator draws everything from the raw bits of mt19937_64 itself. The
+// demands are then shaped with std::log, std::cos and std::sin, which are not
+// correctly rounded, so a seed gives the same workload for a given toolchain
+// and libm, but a few demands may differ between them.
+class Random
+{
+public:
+  explicit Random(std::uint64_t seed) : engine(seed)
+  {
+  }
+
+  // Uniform in [0, 1).
+  double uniform()
+  {
+    return (engine() >> 11) * 0x1.0p-53;
+  }
+
+  bool bernoulli(double probability)
+  {
+    return uniform() < probability;
+  }
+
+  // Box-Muller, one value per call.
+  double normal(double mean, double deviation)
+  {
+    const double radius = std::sqrt(-2 * std::log(1 - uniform()));
+    return mean + deviation * radius * std::cos(2 * M_PI * uniform());
+  }
+
+  // Geometric number of trials until the first success, at least 1, with the
+  // given mean.
+  int geometric(double mean)
+  {
+    if (mean <= 1)
+      return 1;
+    return 1 + int(std::log(1 - uniform()) / std::log(1 - 1 / mean));
+  }
+
+  std::size_t index(std::size_t count)
+  {
+    return std::size_t(uniform() * count);
+  }
+
+private:
+  std::mt19937_64 engine;
+};
+
+int round_demand(double demand)
+{
+  return std::max(0, int(std::lround(demand)));
+}
+
+std::vector<int> generate_demands(Shape shape, const WorkloadOptions &options, Random &random)
+{
+  const std::size_t periods_count = options.periods_count;
+  const double mean = options.mean > 0 ? options.mean : std::max(1.0, options.production_capacity / 2.0);
+  std::vector<int> demands(periods_count);
+
+  switch (shape)
+  {
+  case Shape::seasonal:
+  {
+    const double phase = 2 * M_PI * random.uniform();
+    for (std::size_t period = 0; period < periods_count; ++period)
+    {
+      const double season = std::sin(2 * M_PI * period / options.season_length + phase);
+      demands[period] = round_demand(random.normal(mean * (1 + 0.5 * season), 0.15 * mean));
+    }
+    break;
+  }
+  case Shape::lumpy:
+  {
+    constexpr double order_probability = 0.2;
+    for (auto &demand : demands)
+    {
+      if (random.bernoulli(order_probability))
+        demand = random.geometric(mean / order_probability);
+    }
+    break;
+  }
+  case Shape::trending:
+  {
+    for (std::size_t period = 0; period < periods_count; ++period)
+    {
+      const double trend = periods_count > 1 ? double(period) / (periods_count - 1) : 0;
+      demands[period] = round_demand(random.normal(mean * (0.5 + trend), 0.2 * mean));
+    }
+    break;
+  }
+  case Shape::bursty:
+  {
+    constexpr double burst_probability = 0.03;
+    constexpr double mean_burst_length = 4;
+    int burst_left = 0;
+    for (auto &demand : demands)
+    {
+      if (burst_left == 0 && random.bernoulli(burst_probability))
+        burst_left = random.geometric(mean_burst_length);
+      const double level = burst_left > 0 ? 3 * mean : 0.5 * mean;
+      demand = round_demand(random.normal(level, 0.2 * level));
+      burst_left = std::max(0, burst_left - 1);
+    }
+    break;
+  }
+  case Shape::mixed:
+  {
+    const Shape shapes[] = {Shape::seasonal, Shape::lumpy, Shape::trending, Shape::bursty};
+    return generate_demands(shapes[random.index(4)], options, random);
+  }
+  }
+
+  return demands;
+}
+
+// Lowers the demands no plan can serve, so every generated instance is
+// feasible. Walking back from the last period, need is the stock the period
+// must start with: demand beyond what production and that stock can cover
+// is cut, where the stock is bounded by the store capacity and by what could
+// have been produced before the period (nothing before the first).
+void trim_to_feasible(std::vector<int> &demands, int production_capacity, int store_capacity)
+{
+  long long next_need = 0;
+  for (std::size_t period = demands.size(); period-- > 0;)
+  {
+    const long long max_need = std::min<long long>(store_capacity, (long long)period * production_capacity);
+    const long long max_demand = production_capacity + max_need - next_need;
+    demands[period] = int(std::min<long long>(demands[period], max_demand));
+    next_need = std::max<long long>(0, demands[period] + next_need - production_capacity);
+  }
+}
+
+// Writes one config in the layout of config.json, on a single line for
+// JSONL. The requests are streamed rather than built as a json value so
+// horizons of millions of periods stay cheap.
+void write_config(std::ostream &output, const WorkloadOptions &options, const std::vector<int> &demands, bool compact)
+{
+  // Each key is written with the separator that ends the previous one.
+  const char *separator = compact ? "" : "\n  ";
+  auto key = [&](const char *name) -> std::ostream &
+  {
+    output << separator << '"' << name << "\": ";
+    separator = compact ? ", " : ",\n  ";
+    return output;
+  };
+
+  output << "{";
+  if (!options.engine.empty())
+    key("engine") << '"' << options.engine << '"';
+  if (!options.kernel.empty())
+    key("kernel") << '"' << options.kernel << '"';
+  if (!options.cost_type.empty())
+    key("cost_type") << '"' << options.cost_type << '"';
+  key("store") << "{\"capacity\": " << options.store_capacity << ", \"cost\": " << options.store_cost << "}";
+  key("production") << "{\"capacity\": " << options.production_capacity
+                    << ", \"constant_cost\": " << options.constant_cost << ", \"good_cost\": " << options.good_cost
+                    << "}";
+  key("requests") << "[";
+  for (std::size_t period = 0; period < demands.size(); ++period)
+    output << (period > 0 ? ", " : "") << demands[period];
+  output << "]" << (compact ? "" : "\n") << "}\n";
+}
+
+// std::stoull, except that a sign or trailing characters are rejected
+// rather than wrapped or ignored.
+std::uint64_t parse_unsigned(const std::string &text)
+{
+  std::size_t end = 0;
+  if (text.empty() || text[0] < '0' || text[0] > '9')
+    throw std::invalid_argument("Not a non-negative integer: " + text);
+  const std::uint64_t value = std::stoull(text, &end);
+  if (end != text.size())
+    throw std::invalid_argument("Not a non-negative integer: " + text);
+  return value;
+}
+
+void print_usage(const char *program)
+{
+  std::cerr << "Usage: " << program << " [--shape=seasonal|lumpy|trending|bursty|mixed] [--periods=N]" << std::endl
+            << "       [--count=M] [--seed=S] [--production=P] [--store=S] [--store-cost=H]" << std::endl
+            << "       [--constant-cost=K] [--good-cost=G] [--mean=D] [--season=L]" << std::endl
+            << "       [--engine=E] [--kernel=K] [--cost-type=T] [output]" << std::endl;
+}
+
+// Writes a config (or with --count, a JSONL batch of configs) whose demands
+// follow the requested shape. Config i of a batch is generated from seed + i,
+// so the same arguments give the same output with the same build.
+int main(int argc, char *argv[])
+{
+  WorkloadOptions options;
+  const char *output_path = nullptr;
+  try
+  {
+    for (int arg = 1; arg < argc; ++arg)
+    {
+      const std::string option = argv[arg];
+      if (option.compare(0, 2, "--") != 0)
+      {
+        if (output_path)
+        {
+          print_usage(argv[0]);
+          return 1;
+        }
+        output_path = argv[arg];
+        continue;
+      }
+
+      const std::size_t equals = option.find('=');
+      if (equals == std::string::npos)
+      {
+        print_usage(argv[0]);
+        return 1;
+      }
+      const std::string name = option.substr(0, equals);
+      const std::string value = option.substr(equals + 1);
+      if (name == "--shape")
+        options.shape = shape_from_string(value);
+      else if (name == "--periods")
+        options.periods_count = parse_unsigned(value);
+      else if (name == "--count")
+        options.configs_count = parse_unsigned(value);
+      else if (name == "--seed")
+        options.seed = parse_unsigned(value);
+      else if (name == "--production")
+        options.production_capacity = std::stoi(value);
+      else if (name == "--store")
+        options.store_capacity = std::stoi(value);
+      else if (name == "--store-cost")
+        options.store_cost = std::stoi(value);
+      else if (name == "--constant-cost")
+        options.constant_cost = std::stoi(value);
+      else if (name == "--good-cost")
+        options.good_cost = std::stoi(value);
+      else if (name == "--mean")
+        options.mean = std::stod(value);
+      else if (name == "--season")
+        options.season_length = std::stoi(value);
+      else if (name == "--engine")
+        options.engine = planner_name("engine", value, {"table", "rolling", "checkpoint", "min_plus", "forward"});
+      else if (name == "--kernel")
+        options.kernel = planner_name("kernel", value, {"scalar", "sliding_window", "simd"});
+      else if (name == "--cost-type")
+        options.cost_type = planner_name("cost type", value, {"auto", "int16", "int32", "int64", "checked"});
+      else
+      {
+        print_usage(argv[0]);
+        return 1;
+      }
+    }
+  }
+  catch (const std::exception &exception)
+  {
+    std::cerr << exception.what() << std::endl;
+    print_usage(argv[0]);
+    return 1;
+  }
+
+  if (options.production_capacity < 0 || options.store_capacity < 0 || options.store_cost < 0 ||
+      options.constant_cost < 0 || options.good_cost < 0 || options.season_length <= 0)
+  {
+    print_usage(argv[0]);
+    return 1;
+  }
+
+  std::ofstream output_file;
+  if (output_path)
+  {
+    output_file.open(output_path);
+    if (!output_file)
+    {
+      std::cerr << "Cannot open " << output_path << std::endl;
+      return 1;
+    }
+  }
+  std::ostream &output = output_path ? output_file : std::cout;
+
+  const std::size_t configs_count = std::max<std::size_t>(options.configs_count, 1);
+  for (std::size_t config = 0; config < configs_count; ++config)
+  {
+    Random random(options.seed + config);
+    std::vector<int> demands = generate_demands(options.shape, options, random);
+    trim_to_feasible(demands, options.production_capacity, options.store_capacity);
+    write_config(output, options, demands, options.configs_count > 0);
+  }
+
+  return output ? 0 : 1;
+}
@@ -0,0 +1,169 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+
+#include "perf_counters.hpp"
+
+// Per-stage counters of the planner's hot path are compiled in by defining
+// DP_INSTRUMENTATION (the DP_INSTRUMENTATION CMake option); otherwise every
+// update below is discarded at compile time.
+#ifdef DP_INSTRUMENTATION
+constexpr bool instrumentation_enabled = true;
+#else
+constexpr bool instrumentation_enabled = false;
+#endif
+
+// The continue branches by which a kernel drops a candidate production
+// quantity.
+enum class SkipReason
+{
+  // A state above the empty store in the last stage (the first period).
+  last_stage_state,
+  // Supply other than the demand in stage 0, which must leave the store
+  // empty.
+  first_stage_supply,
+  // Less supply than demand.
+  short_supply,
+  // The inventory left is outside the states of the stage read.
+  outside_states,
+  // The state read has no feasible plan.
+  infeasible_state,
+  // More than the production capacity.
+  over_capacity,
+};
+
+constexpr std::size_t skip_reasons_count = 6;
+
+inline const char *to_string(SkipReason reason)
+{
+  switch (reason)
+  {
+  case SkipReason::last_stage_state:
+    return "last_stage_state";
+  case SkipReason::first_stage_supply:
+    return "first_stage_supply";
+  case SkipReason::short_supply:
+    return "short_supply";
+  case SkipReason::outside_states:
+    return "outside_states";
+  case SkipReason::infeasible_state:
+    return "infeasible_state";
+  default:
+    return "over_capacity";
+  }
+}
+
+// Bytes allocated by the current thread. The planner cannot see allocations
+// by itself: a program built with DP_INSTRUMENTATION reports them through
+// count_allocation from its replacement operator new, as main.cpp does.
+inline thread_local std::uint64_t thread_allocated_bytes = 0;
+
+inline void count_allocation(std::size_t size)
+{
+  if constexpr (instrumentation_enabled)
+    thread_allocated_bytes += size;
+}
+
+// Work done calculating one stage. Kernels only count the candidates they
+// visit: the scalar kernel tries every production quantity, while the
+// vectorized and sliding window kernels never look at those outside the
+// states of the stage read, so those are not counted as skipped.
+struct StageCounters
+{
+  std::uint64_t states_visited = 0;
+  std::uint64_t candidates_evaluated = 0;
+  std::uint64_t candidates_skipped[skip_reasons_count] = {};
+  // Time spent in the stage's chunks, summed over the threads running them.
+  std::uint64_t nanoseconds = 0;
+  std::uint64_t bytes_allocated = 0;
+  // Hardware events of the chunks, when the threads running them could open
+  // their counters. Each chunk pays for two reads of them.
+  PerfSample perf;
+
+  void visit_state()
+  {
+    if constexpr (instrumentation_enabled)
+      ++states_visited;
+  }
+
+  void evaluate(std::uint64_t candidates = 1)
+  {
+    if constexpr (instrumentation_enabled)
+      candidates_evaluated += candidates;
+  }
+
+  void skip(SkipReason reason)
+  {
+    if constexpr (instrumentation_enabled)
+      ++candidates_skipped[std::size_t(reason)];
+  }
+
+  StageCounters &operator+=(const StageCounters &other)
+  {
+    states_visited += other.states_visited;
+    candidates_evaluated += other.candidates_evaluated;
+    for (std::size_t reason = 0; reason < skip_reasons_count; ++reason)
+      candidates_skipped[reason] += other.candidates_skipped[reason];
+    nanoseconds += other.nanoseconds;
+    bytes_allocated += other.bytes_allocated;
+    perf += other.perf;
+    return *this;
+  }
+};
+
+// Measures the time, the current thread's allocations and its hardware
+// events between its construction and stop.
+class StageTimer
+{
+public:
+  StageTimer()
+  {
+    if constexpr (instrumentation_enabled)
+    {
+      // Opening the thread's counters on first use allocates; keep that out
+      // of the measured bytes and time.
+      const PerfCounters &perf_counters = thread_perf_counters();
+      start_bytes = thread_allocated_bytes;
+      start_perf = perf_counters.read();
+      start = std::chrono::steady_clock::now();
+    }
+  }
+
+  void stop(StageCounters &counters) const
+  {
+    if constexpr (instrumentation_enabled)
+    {
+      const auto elapsed = std::chrono::steady_clock::now() - start;
+      counters.perf += thread_perf_counters().read() - start_perf;
+      counters.nanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+      counters.bytes_allocated += thread_allocated_bytes - start_bytes;
+    }
+  }
+
+private:
+  std::chrono::steady_clock::time_point start;
+  std::uint64_t start_bytes = 0;
+  PerfSample start_perf;
+};
+
+// Writes the counters' fields as the members of a JSON object, without the
+// braces. Hardware events are only written when they were counted.
+inline void write_counters_json(std::ostream &output, const StageCounters &counters)
+{
+  output << "\"states_visited\": " << counters.states_visited
+         << ", \"candidates_evaluated\": " << counters.candidates_evaluated << ", \"candidates_skipped\": {";
+  for (std::size_t reason = 0; reason < skip_reasons_count; ++reason)
+    output << (reason > 0 ? ", " : "") << '"' << to_string(SkipReason(reason)) << "\": "
+           << counters.candidates_skipped[reason];
+  output << "}, \"nanoseconds\": " << counters.nanoseconds << ", \"bytes_allocated\": " << counters.bytes_allocated;
+  for (std::size_t event = 0; event < perf_events_count; ++event)
+  {
+    if (counters.perf.has(PerfEvent(event)))
+      output << ", \"" << to_string(PerfEvent(event)) << "\": " << counters.perf.values[event];
+  }
+  if (counters.perf.has(PerfEvent::cycles) && counters.perf.has(PerfEvent::instructions))
+    output << ", \"ipc\": " << counters.perf.ipc();
+}
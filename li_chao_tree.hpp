@@ -0,0 +1,91 @@
+#pragma once
+
+#include <algorithm>
+#include <limits>
+#include <optional>
+#include <vector>
+
+// Lower envelope of lines over the integer points [0, size), answering
+// minimum queries in O(log size).
+class LiChaoTree
+{
+  struct Line
+  {
+    long long intercept;
+    long long slope;
+
+    long long at(long long x) const { return intercept + slope * x; }
+  };
+
+  std::vector<std::optional<Line>> nodes;
+  long long size = 0;
+
+  void insert(Line line, std::size_t node, long long first, long long last)
+  {
+    if (!nodes[node])
+    {
+      nodes[node] = line;
+      return;
+    }
+
+    const long long middle = (first + last) / 2;
+    Line &current = nodes[node].value();
+    if (line.at(middle) < current.at(middle))
+      std::swap(line, current);
+
+    if (first == last)
+      return;
+
+    if (line.at(first) < current.at(first))
+      insert(line, 2 * node, first, middle);
+    else if (line.at(last) < current.at(last))
+      insert(line, 2 * node + 1, middle + 1, last);
+  }
+
+public:
+  LiChaoTree() = default;
+
+  explicit LiChaoTree(long long i_size)
+  {
+    reset(i_size);
+  }
+
+  // Empties the envelope over [0, i_size), keeping the node storage.
+  void reset(long long i_size)
+  {
+    nodes.assign(4 * std::max(i_size, 1LL), std::nullopt);
+    size = i_size;
+  }
+
+  void insert(long long intercept, long long slope)
+  {
+    insert(Line{intercept, slope}, 1, 0, size - 1);
+  }
+
+  long long minimum(long long x) const
+  {
+    long long result = std::numeric_limits<long long>::max();
+    std::size_t node = 1;
+    long long first = 0;
+    long long last = size - 1;
+    while (nodes[node])
+    {
+      result = std::min(result, nodes[node]->at(x));
+      if (first == last)
+        break;
+
+      const long long middle = (first + last) / 2;
+      if (x <= middle)
+      {
+        node = 2 * node;
+        last = middle;
+      }
+      else
+      {
+        node = 2 * node + 1;
+        first = middle + 1;
+      }
+    }
+    return result;
+  }
+};
@@ -1,278 +1,405 @@
 #include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
 #include <fstream>
 #include <iostream>
-#include <optional>
+#include <new>
+#include <stdexcept>
 #include <string>
+#include <thread>
 #include <vector>
-#include <iomanip>
 
+#include "cost.hpp"
+#include "dp_production_planner.hpp"
 #include "json.hpp"
+#include "trace.hpp"
+#include "work_stealing.hpp"
 
 using json = nlohmann::json;
 
-void print_table(const std::vector<std::vector<std::string>> &table)
+#ifdef DP_INSTRUMENTATION
+// Reports every heap allocation to the planner's stage counters. Kept out of
+// line so that free is never seen on a pointer from operator new.
+__attribute__((noinline)) void *operator new(std::size_t size)
 {
-  constexpr char boxing[] = "++|-+++++++";
-  constexpr std::size_t pad_size = 2;
-  std::vector<std::size_t> columns_width;
-  for (std::size_t col_index = 0; col_index < table[0].size(); ++col_index)
-  {
-    std::optional<std::size_t> max_width;
-    for (std::size_t row_index = 0; row_index < table.size(); ++row_index)
-    {
-      if (!max_width || max_width.value() < table[row_index][col_index].length() + pad_size)
-        max_width = table[row_index][col_index].length() + pad_size;
-    }
+  count_allocation(size);
+  if (void *pointer = std::malloc(size > 0 ? size : 1))
+    return pointer;
+  throw std::bad_alloc();
+}
 
-    columns_width.emplace_back(max_width.value());
-  }
+__attribute__((noinline)) void *operator new[](std::size_t size)
+{
+  return operator new(size);
+}
 
-  std::cout << boxing[8];
-  for (std::size_t col_index = 0; col_index < table[0].size(); ++col_index)
-  {
-    std::cout << std::string(columns_width[col_index], boxing[3]);
-    if (col_index < table[0].size() - 1)
-      std::cout << boxing[1];
-    else
-      std::cout << boxing[7] << std::endl;
-  }
+__attribute__((noinline)) void operator delete(void *pointer) noexcept
+{
+  std::free(pointer);
+}
 
-  for (std::size_t row_index = 0; row_index < table.size(); ++row_index)
-  {
-    std::cout << boxing[2];
-    for (std::size_t col_index = 0; col_index < table[0].size(); ++col_index)
-    {
-      std::cout << std::setw(columns_width[col_index]) << table[row_index][col_index];
-      std::cout << boxing[2];
-    }
-    std::cout << std::endl;
+__attribute__((noinline)) void operator delete[](void *pointer) noexcept
+{
+  operator delete(pointer);
+}
 
-    if (row_index == table.size() - 1)
-      continue;
-    std::cout << boxing[10];
-    for (std::size_t col_index = 0; col_index < table[0].size(); ++col_index)
-    {
-      std::cout << std::string(columns_width[col_index], boxing[3]);
-      if (col_index < table[0].size() - 1)
-        std::cout << boxing[4];
-      else
-        std::cout << boxing[9] << std::endl;
-    }
-  }
-  std::cout << boxing[5];
-  for (std::size_t col_index = 0; col_index < table[0].size(); ++col_index)
-  {
-    std::cout << std::string(columns_width[col_index], boxing[3]);
-    if (col_index < table[0].size() - 1)
-      std::cout << boxing[0];
-    else
-      std::cout << boxing[6] << std::endl;
-  }
+__attribute__((noinline)) void operator delete(void *pointer, std::size_t) noexcept
+{
+  operator delete(pointer);
 }
 
-class DpProductionPlanner
+__attribute__((noinline)) void operator delete[](void *pointer, std::size_t) noexcept
 {
+  operator delete(pointer);
+}
+#endif
 
-  struct State
-  {
-    std::vector<std::optional<int>> decisions;
-    std::optional<int> optimal_cost;
-    std::optional<int> optimal_decision;
-  };
+DpProductionPlanner::Options options_from_config(const json &config)
+{
+  DpProductionPlanner::Options options;
+  options.engine = DpProductionPlanner::engine_from_string(config.value("engine", "table"));
+  options.kernel = DpProductionPlanner::kernel_from_string(config.value("kernel", "scalar"));
+  options.prune_states = config.value("prune_states", true);
+  options.lot_sizing = config.value("lot_sizing", true);
+  options.specialize_small_capacities = config.value("specialize_small_capacities", true);
+  options.split_segments = config.value("split_segments", true);
+  // A config cannot ask for more threads than the machine has cores.
+  const long long threads = config.value("threads", 1LL);
+  if (threads < 0)
+    throw std::invalid_argument("Invalid threads: " + std::to_string(threads));
+  options.threads = std::min<unsigned long long>(threads, std::max(std::thread::hardware_concurrency(), 1U));
+  options.output = DpProductionPlanner::output_from_string(config.value("output", "summary"));
+  return options;
+}
 
-  struct Stage
-  {
-    std::vector<State> states;
-  };
+// The config's cost_type, or for "auto" the narrowest one that cannot
+// overflow on its instance.
+CostType cost_type_from_config(const json &config)
+{
+  const CostType cost_type = cost_type_from_string(config.value("cost_type", "auto"));
+  if (cost_type != CostType::automatic)
+    return cost_type;
+
+  return select_cost_type(config.at("requests").size(), config.at("store").at("capacity"),
+                          config.at("store").at("cost"), config.at("production").at("constant_cost"));
+}
 
-  static auto init_stages(int production_capacity, int store_capacity, int stages_count)
+// One planner per cost type, each keeping its buffers across the configs it
+// solves.
+struct Planners
+{
+  BasicDpProductionPlanner<std::int16_t> int16;
+  BasicDpProductionPlanner<std::int32_t> int32;
+  BasicDpProductionPlanner<std::int64_t> int64;
+  BasicDpProductionPlanner<CheckedCost> checked;
+};
+
+// Calls function with the planner of cost_type.
+template <typename Function>
+void with_planner(Planners &planners, CostType cost_type, Function &&function)
+{
+  switch (cost_type)
   {
-    std::vector<Stage> stages;
+  case CostType::int16:
+    function(planners.int16);
+    break;
+  case CostType::int32:
+    function(planners.int32);
+    break;
+  case CostType::int64:
+    function(planners.int64);
+    break;
+  default:
+    function(planners.checked);
+    break;
+  }
+}
 
-    stages.resize(stages_count);
+template <typename Planner>
+void reset_from_config(Planner &dpp, const json &config, const DpProductionPlanner::Options &options,
+                       std::vector<int> &requests)
+{
+  const json &config_requests = config.at("requests");
+  requests.assign(config_requests.begin(), config_requests.end());
+
+  dpp.reset(config.at("production").at("capacity"),
+            config.at("store").at("capacity"),
+            config.at("store").at("cost"),
+            config.at("production").at("constant_cost"),
+            config.at("production").at("good_cost"),
+            requests,
+            options);
+}
 
-    for (auto &stage : stages)
-    {
-      stage.states.resize(store_capacity + 1);
+json parse_config(const std::string &line)
+{
+  const TraceSpan span("parse_config");
+  return json::parse(line);
+}
 
-      for (auto &state : stage.states)
-        state.decisions.resize(production_capacity + 1);
-    }
+// One line of batch output. Error messages may quote invalid UTF-8 from the
+// input line, which is replaced rather than thrown on.
+std::string dump_result(const json &result)
+{
+  return result.dump(-1, ' ', false, json::error_handler_t::replace);
+}
 
-    return stages;
-  }
+bool is_blank(const std::string &line)
+{
+  return line.find_first_not_of(" \t\r") == std::string::npos;
+}
 
-  static std::string to_string(const std::optional<int> &opt_int)
+// Solves the config on one line of a batch into result. A line that fails to
+// parse yields an error result. With an executor, the states of each stage
+// are split on it instead of the config's threads.
+void solve_line(Planners &planners, std::vector<int> &requests, const std::string &line, json &result,
+                ParallelFor *executor = nullptr)
+{
+  result.clear();
+  try
   {
-    if (opt_int)
-      return std::to_string(opt_int.value());
-
-    return "-";
+    const json config = parse_config(line);
+    DpProductionPlanner::Options options = options_from_config(config);
+    options.output = DpProductionPlanner::Output::none;
+    options.executor = executor;
+
+    with_planner(planners, cost_type_from_config(config), [&](auto &dpp)
+                 {
+      reset_from_config(dpp, config, options, requests);
+      dpp.calculate_stages();
+      if (dpp.trace_plan())
+      {
+        result["decisions"] = dpp.decisions();
+        result["total_cost"] = dpp.total_cost();
+      }
+      else
+        result["error"] = "No solution found"; });
   }
+  catch (const std::exception &exception)
+  {
+    result["error"] = exception.what();
+  }
+}
+
+// Solves one config per line of input and writes one result per line to
+// output, keeping a single set of planners (and their buffers) for the whole
+// stream. Blank lines are skipped.
+void run_batch(std::istream &input, std::ostream &output)
+{
+  Planners planners;
+  std::vector<int> requests;
+  std::string line;
+  json result;
 
-  static void print_stage(const Stage &stage)
+  for (std::size_t config = 0; std::getline(input, line);)
   {
-    std::vector<std::vector<std::string>> table;
+    if (is_blank(line))
+      continue;
 
-    std::vector<std::string> header;
-    header.push_back("s\\x");
-    for (std::size_t i = 0; i < stage.states[0].decisions.size(); ++i)
-      header.push_back(std::to_string(i));
-    header.push_back("optimal cost");
-    header.push_back("x*");
+    const TraceSpan span("solve_line", "config", config++);
+    solve_line(planners, requests, line, result);
+    const TraceSpan write_span("write_result");
+    output << dump_result(result) << '\n';
+  }
+  output.flush();
+}
 
-    table.push_back(header);
+// run_batch on a work-stealing executor: lines are read in blocks whose
+// configs are solved concurrently, each worker reusing its own planners, and
+// written in input order.
+void run_parallel_batch(std::istream &input, std::ostream &output, std::size_t workers_count)
+{
+  constexpr std::size_t block_size = 4096;
+
+  WorkStealingExecutor executor(workers_count);
+  std::vector<Planners> planners(executor.size());
+  std::vector<std::vector<int>> requests(executor.size());
+  std::vector<std::string> lines;
+  std::vector<std::string> results;
+  std::vector<WorkStealingExecutor::Job> jobs;
+  std::string line;
+  // Index of the block's first config in the whole batch.
+  std::size_t first_config = 0;
+
+  bool reading = true;
+  while (reading)
+  {
+    lines.clear();
+    while (lines.size() < block_size && (reading = bool(std::getline(input, line))))
+    {
+      if (!is_blank(line))
+        lines.push_back(line);
+    }
 
-    for (std::size_t state_it = 0; state_it < stage.states.size(); ++state_it)
+    results.resize(lines.size());
+    for (std::size_t index = 0; index < lines.size(); ++index)
     {
-      std::vector<std::string> row;
-      row.push_back(std::to_string(state_it));
-      for (std::size_t x = 0; x < stage.states[state_it].decisions.size(); ++x)
-      {
-        row.push_back(to_string(stage.states[state_it].decisions[x]));
-      }
-      row.push_back(to_string(stage.states[state_it].optimal_cost));
-      row.push_back(to_string(stage.states[state_it].optimal_decision));
-      table.push_back(row);
+      jobs.push_back([&, index](std::size_t worker)
+                     {
+        const TraceSpan span("solve_line", "config", first_config + index);
+        json result;
+        solve_line(planners[worker], requests[worker], lines[index], result, &executor.worker_parallel_for(worker));
+        const TraceSpan write_span("write_result");
+        results[index] = dump_result(result); });
     }
+    executor.run(jobs);
 
-    print_table(table);
-    std::cout << std::endl;
+    const TraceSpan span("write_results", "configs", results.size());
+    for (const auto &result : results)
+      output << result << '\n';
+    first_config += results.size();
   }
+  output.flush();
+}
 
-  const std::size_t production_capacity;
-  const std::size_t store_capacity;
-  const std::size_t store_cost;
-  const std::size_t constant_production_cost;
-  const std::size_t good_production_cost;
+// The positive count of --workers=N, or 0 when text is not one.
+std::size_t parse_workers_count(const char *text)
+{
+  if (*text < '0' || *text > '9')
+    return 0;
+
+  char *end = nullptr;
+  errno = 0;
+  const unsigned long count = std::strtoul(text, &end, 10);
+  if (*end != '\0' || errno == ERANGE)
+    return 0;
+  return count;
+}
 
-  std::vector<Stage> stages;
-  std::vector<int> requests;
-  std::vector<int> reversed_requests;
+void print_usage(const char *program)
+{
+  std::cerr << "Usage: " << program << " [--output=none|summary|full] [--trace=trace.json] [config.json]" << std::endl
+            << "       " << program << " --batch [--workers=N] [--trace=trace.json] <input.jsonl> [output.jsonl]"
+            << std::endl
+            << "--trace writes a Chrome trace-event timeline of the solver phases." << std::endl;
+}
 
-public:
-  void trace_stages()
+int main(int argc, char *argv[])
+{
+  if (argc > 1 && std::strcmp(argv[1], "--batch") == 0)
   {
-    std::vector<std::size_t> results;
-    std::size_t used_store_space = 0;
-    for (int stage_index = stages.size() - 1; stage_index >= 0; stage_index--)
+    std::size_t workers_count = 1;
+    std::vector<const char *> paths;
+    for (int arg = 2; arg < argc; ++arg)
     {
-      const auto &state = stages[stage_index].states[used_store_space];
-      if (state.optimal_decision)
+      if (std::strncmp(argv[arg], "--workers=", 10) == 0)
       {
-        results.emplace_back(state.optimal_decision.value());
-        if (stage_index > 0)
-          used_store_space += state.optimal_decision.value() - reversed_requests[stage_index];
+        workers_count = parse_workers_count(argv[arg] + 10);
+        if (workers_count == 0)
+        {
+          std::cerr << "Invalid worker count: " << argv[arg] + 10 << std::endl;
+          print_usage(argv[0]);
+          return 1;
+        }
       }
+      else if (std::strncmp(argv[arg], "--trace=", 8) == 0)
+        Trace::start(argv[arg] + 8);
       else
-      {
-        std::cout << "No solution found!" << std::endl;
-        return;
-      }
+        paths.push_back(argv[arg]);
+    }
+    if (paths.empty() || paths.size() > 2)
+    {
+      print_usage(argv[0]);
+      return 1;
     }
-    std::cout << "Optimal decisions:" << std::endl;
-    for (auto iterator = results.begin(); iterator < results.end(); iterator++)
-      std::cout << "x" << (iterator - results.begin()) << ": " << (*iterator) << std::endl;
 
-    std::size_t total_cost = 0;
-    for (auto &&request : requests)
-      total_cost += good_production_cost * request;
+    std::ifstream input(paths[0]);
+    if (!input)
+    {
+      std::cerr << "Cannot open " << paths[0] << std::endl;
+      return 1;
+    }
 
-    total_cost += stages.back().states[0].optimal_cost.value();
+    std::ofstream output_file;
+    if (paths.size() > 1)
+      output_file.open(paths[1]);
+    std::ostream &output = paths.size() > 1 ? output_file : std::cout;
 
-    std::cout << "Total cost: " << total_cost << std::endl;
-  }
+    if (workers_count > 1)
+      run_parallel_batch(input, output, workers_count);
+    else
+      run_batch(input, output);
 
-  DpProductionPlanner(const std::size_t i_production_capacity,
-                      const std::size_t i_store_capacity,
-                      const std::size_t i_store_cost,
-                      const std::size_t i_constant_production_cost,
-                      const std::size_t i_good_production_cost,
-                      const std::vector<int> &i_requests) : production_capacity(i_production_capacity),
-                                                            store_capacity(i_store_capacity),
-                                                            store_cost(i_store_cost),
-                                                            constant_production_cost(i_constant_production_cost),
-                                                            good_production_cost(i_good_production_cost),
-                                                            stages(init_stages(production_capacity, store_capacity, i_requests.size())),
-                                                            requests(i_requests),
-                                                            reversed_requests(i_requests.size())
-  {
-    std::reverse_copy(i_requests.begin(), i_requests.end(), reversed_requests.begin());
+    return 0;
   }
 
-  void calculate_stages()
+  const char *config_path = "config.json";
+  const char *output = nullptr;
+  for (int arg = 1; arg < argc; ++arg)
   {
-    for (int stage_it = 0; stage_it < reversed_requests.size(); ++stage_it)
+    if (std::strncmp(argv[arg], "--output=", 9) == 0)
+      output = argv[arg] + 9;
+    else if (std::strncmp(argv[arg], "--trace=", 8) == 0)
+      Trace::start(argv[arg] + 8);
+    else if (argv[arg][0] == '-')
     {
-      for (int state = 0; state <= store_capacity; ++state)
-      {
-        std::optional<int> optimal_cost;
-        std::optional<int> optimal_decision;
-
-        for (int x = 0; x <= production_capacity; ++x)
-        {
-          int total_supply = state + x;
-
-          // Last stage
-          if (stage_it == reversed_requests.size() - 1 && state > 0)
-            continue;
-
-          // Initial stage
-          if (stage_it == 0 && total_supply != reversed_requests[stage_it])
-            continue;
-
-          if (total_supply < reversed_requests[stage_it])
-            continue;
-
-          int to_store = total_supply - reversed_requests[stage_it];
-          if (stage_it > 0 && !stages[stage_it - 1].states[to_store].optimal_cost)
-          {
-            continue;
-          }
-
-          int production_cost = x > 0 ? constant_production_cost : 0;
-          int current_store_cost = store_cost * state;
-          int total_cost = production_cost + current_store_cost;
-
-          if (stage_it > 0)
-            total_cost +=
-                stages[stage_it - 1].states[to_store].optimal_cost.value();
-
-          stages[stage_it].states[state].decisions[x] = total_cost;
-          if (!optimal_cost || optimal_cost.value() > total_cost)
-          {
-            optimal_cost = total_cost;
-            optimal_decision = x;
-          }
-        }
-
-        stages[stage_it].states[state].optimal_cost = optimal_cost;
-        stages[stage_it].states[state].optimal_decision = optimal_decision;
-      }
-      std::cout << "Stage " << reversed_requests.size() - stage_it << ":" << std::endl;
-      print_stage(stages[stage_it]);
+      print_usage(argv[0]);
+      return 1;
     }
+    else
+      config_path = argv[arg];
   }
-};
 
-int main()
-{
-  std::ifstream config_stream("config.json");
-  json config;
-  config_stream >> config;
+  std::ifstream config_stream(config_path);
+  if (!config_stream)
+  {
+    std::cerr << "Cannot open " << config_path << std::endl;
+    return 1;
+  }
 
-  std::vector<int> requests(config["requests"].size());
-  std::copy(config["requests"].begin(), config["requests"].end(), requests.begin());
+  json config;
+  try
+  {
+    const TraceSpan span("parse_config");
+    config_stream >> config;
+  }
+  catch (const json::parse_error &exception)
+  {
+    std::cerr << "Cannot parse " << config_path << ": " << exception.what() << std::endl;
+    return 1;
+  }
 
-  DpProductionPlanner dpp(config["production"]["capacity"],
-                          config["store"]["capacity"],
-                          config["store"]["cost"],
-                          config["production"]["constant_cost"],
-                          config["production"]["good_cost"],
-                          requests);
+  DpProductionPlanner::Options options;
+  try
+  {
+    options = options_from_config(config);
+    if (output)
+      options.output = DpProductionPlanner::output_from_string(output);
+  }
+  catch (const std::invalid_argument &exception)
+  {
+    std::cerr << exception.what() << std::endl;
+    print_usage(argv[0]);
+    return 1;
+  }
+  catch (const json::exception &exception)
+  {
+    std::cerr << "Invalid config " << config_path << ": " << exception.what() << std::endl;
+    return 1;
+  }
 
-  dpp.calculate_stages();
-  dpp.trace_stages();
+  std::vector<int> requests;
+  Planners planners;
+  try
+  {
+    with_planner(planners, cost_type_from_config(config), [&](auto &dpp)
+                 {
+      reset_from_config(dpp, config, options, requests);
+      dpp.calculate_stages();
+      dpp.trace_stages(); });
+  }
+  catch (const json::exception &exception)
+  {
+    std::cerr << "Invalid config " << config_path << ": " << exception.what() << std::endl;
+    return 1;
+  }
+  catch (const std::exception &exception)
+  {
+    std::cerr << exception.what() << std::endl;
+    return 1;
+  }
 
   return 0;
-}
\ No newline at end of file
+}
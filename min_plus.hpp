@@ -0,0 +1,50 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+
+// Dense (min, +) algebra on row-major matrices where infinity marks a missing
+// entry. Sums are only formed from two finite operands.
+
+// result = left (rows x inner) * right (inner x columns)
+template <typename Cost>
+void min_plus_multiply(const Cost *left, const Cost *right, Cost *result, std::size_t rows_count,
+                       std::size_t inner_count, std::size_t columns_count, Cost infinity)
+{
+  std::fill(result, result + rows_count * columns_count, infinity);
+  for (std::size_t row = 0; row < rows_count; ++row)
+  {
+    Cost *result_row = result + row * columns_count;
+    for (std::size_t inner = 0; inner < inner_count; ++inner)
+    {
+      const Cost left_cost = left[row * inner_count + inner];
+      if (left_cost == infinity)
+        continue;
+
+      const Cost *right_row = right + inner * columns_count;
+      for (std::size_t column = 0; column < columns_count; ++column)
+      {
+        if (right_row[column] != infinity)
+          result_row[column] = std::min<Cost>(result_row[column], left_cost + right_row[column]);
+      }
+    }
+  }
+}
+
+// result = matrix (rows x columns) * vector (columns)
+template <typename Cost>
+void min_plus_apply(const Cost *matrix, const Cost *vector, Cost *result, std::size_t rows_count,
+                    std::size_t columns_count, Cost infinity)
+{
+  for (std::size_t row = 0; row < rows_count; ++row)
+  {
+    Cost best = infinity;
+    const Cost *matrix_row = matrix + row * columns_count;
+    for (std::size_t column = 0; column < columns_count; ++column)
+    {
+      if (matrix_row[column] != infinity && vector[column] != infinity)
+        best = std::min<Cost>(best, matrix_row[column] + vector[column]);
+    }
+    result[row] = best;
+  }
+}
@@ -0,0 +1,211 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#ifdef __linux__
+#include <cerrno>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Hardware events counted around the DP kernel.
+enum class PerfEvent
+{
+  cycles,
+  instructions,
+  // Last level cache misses.
+  cache_misses,
+  branch_misses,
+};
+
+constexpr std::size_t perf_events_count = 4;
+
+inline const char *to_string(PerfEvent event)
+{
+  switch (event)
+  {
+  case PerfEvent::cycles:
+    return "cycles";
+  case PerfEvent::instructions:
+    return "instructions";
+  case PerfEvent::cache_misses:
+    return "cache_misses";
+  default:
+    return "branch_misses";
+  }
+}
+
+// Counts of the events between two reads. Events that could not be opened
+// stay zero and are left out of measured.
+struct PerfSample
+{
+  std::uint64_t values[perf_events_count] = {};
+  // Bit e is set when PerfEvent(e) was counted.
+  unsigned measured = 0;
+
+  bool has(PerfEvent event) const
+  {
+    return measured & (1u << std::size_t(event));
+  }
+
+  std::uint64_t operator[](PerfEvent event) const
+  {
+    return values[std::size_t(event)];
+  }
+
+  // Instructions per cycle, or 0 when either was not counted.
+  double ipc() const
+  {
+    if (!has(PerfEvent::cycles) || !has(PerfEvent::instructions) || (*this)[PerfEvent::cycles] == 0)
+      return 0;
+    return double((*this)[PerfEvent::instructions]) / (*this)[PerfEvent::cycles];
+  }
+
+  PerfSample &operator+=(const PerfSample &other)
+  {
+    for (std::size_t event = 0; event < perf_events_count; ++event)
+      values[event] += other.values[event];
+    measured |= other.measured;
+    return *this;
+  }
+
+  friend PerfSample operator-(const PerfSample &end, const PerfSample &start)
+  {
+    PerfSample difference;
+    for (std::size_t event = 0; event < perf_events_count; ++event)
+      difference.values[event] = end.values[event] - start.values[event];
+    difference.measured = end.measured & start.measured;
+    return difference;
+  }
+};
+
+// User-space hardware counters of the calling thread, opened as one
+// perf_event_open group so a single read returns all of them. Without the
+// system call (other platforms, seccomp), without a PMU (most virtual
+// machines) or when perf_event_paranoid forbids it, the counters are
+// unavailable and reads return empty samples; events the PMU lacks are
+// left out individually. Counts are scaled up when the kernel multiplexes
+// the group.
+class PerfCounters
+{
+public:
+  PerfCounters()
+  {
+#ifdef __linux__
+    static constexpr std::uint64_t configs[perf_events_count] = {
+        PERF_COUNT_HW_CPU_CYCLES,
+        PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_CACHE_MISSES,
+        PERF_COUNT_HW_BRANCH_MISSES,
+    };
+
+    for (std::size_t event = 0; event < perf_events_count; ++event)
+    {
+      perf_event_attr attributes;
+      std::memset(&attributes, 0, sizeof(attributes));
+      attributes.size = sizeof(attributes);
+      attributes.type = PERF_TYPE_HARDWARE;
+      attributes.config = configs[event];
+      attributes.disabled = leader < 0;
+      attributes.exclude_kernel = 1;
+      attributes.exclude_hv = 1;
+      attributes.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+      const int descriptor = syscall(SYS_perf_event_open, &attributes, 0, -1, leader, 0);
+      if (descriptor < 0)
+      {
+        if (unavailable_reason.empty())
+          unavailable_reason = std::string(to_string(PerfEvent(event))) + ": " + std::strerror(errno);
+        continue;
+      }
+
+      if (leader < 0)
+        leader = descriptor;
+      descriptors[events_count] = descriptor;
+      group_events[events_count++] = event;
+      measured |= 1u << event;
+    }
+
+    if (leader >= 0)
+    {
+      unavailable_reason.clear();
+      ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+      ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+#else
+    unavailable_reason = "perf_event_open needs Linux";
+#endif
+  }
+
+  PerfCounters(const PerfCounters &) = delete;
+  PerfCounters &operator=(const PerfCounters &) = delete;
+
+  ~PerfCounters()
+  {
+#ifdef __linux__
+    // The leader, opened first, is closed last.
+    for (std::size_t member = events_count; member-- > 0;)
+      close(descriptors[member]);
+#endif
+  }
+
+  bool available() const
+  {
+    return measured != 0;
+  }
+
+  // Why no event could be counted; empty when some are.
+  const std::string &why_unavailable() const
+  {
+    return unavailable_reason;
+  }
+
+  // Counts since the counters were opened; subtract two reads for the
+  // events in between.
+  PerfSample read() const
+  {
+    PerfSample sample;
+#ifdef __linux__
+    if (leader < 0)
+      return sample;
+
+    // nr, time_enabled, time_running, then one value per event.
+    std::uint64_t buffer[3 + perf_events_count];
+    if (::read(leader, buffer, sizeof(buffer)) < ssize_t((3 + events_count) * sizeof(std::uint64_t)))
+      return sample;
+
+    const std::uint64_t enabled = buffer[1];
+    const std::uint64_t running = buffer[2];
+    for (std::size_t member = 0; member < events_count; ++member)
+    {
+      std::uint64_t value = buffer[3 + member];
+      if (running > 0 && running < enabled)
+        value = std::uint64_t(double(value) * enabled / running);
+      sample.values[group_events[member]] = value;
+    }
+    sample.measured = measured;
+#endif
+    return sample;
+  }
+
+private:
+  int leader = -1;
+  // The descriptors and events of the group in the order they were opened.
+  int descriptors[perf_events_count] = {};
+  std::size_t group_events[perf_events_count] = {};
+  std::size_t events_count = 0;
+  unsigned measured = 0;
+  std::string unavailable_reason;
+};
+
+// The counters of the calling thread, opened on first use.
+inline const PerfCounters &thread_perf_counters()
+{
+  static thread_local const PerfCounters counters;
+  return counters;
+}
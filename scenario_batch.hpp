@@ -0,0 +1,304 @@
+#pragma once
+
+#include <algorithm>
+#include <climits>
+#include <cstddef>
+#include <numeric>
+#include <stdexcept>
+#include <vector>
+
+#include "argmin.hpp"
+#include "cost.hpp"
+
+// Solves many instances that share capacities, costs and horizon length and
+// only differ in their requests, eight scenarios (lanes) at a time. Costs are
+// laid out state-major with the lanes of a state next to each other, so the
+// previous-stage costs every lane needs for one stored amount are a single
+// vector load. Each lane reaches to_store = state + x - demand with its own
+// production quantity x, so the kernels loop over to_store rather than x,
+// which keeps the loads shared and turns the per-lane demand into a mask
+// instead of a gather. Plans match DpProductionPlanner's backward stages
+// without state pruning, with the same preference for the smallest x.
+// Lanes hold 32-bit costs, so reset rejects batches whose cost bound (see
+// select_cost_type) does not fit them. The batch is only driven by dp_bench;
+// dp --batch solves every line with the main planner.
+class ScenarioBatchPlanner
+{
+public:
+  using Cost = int;
+
+  static constexpr Cost infeasible_cost = INT_MAX;
+  static constexpr int no_decision = -1;
+  static constexpr int lanes = 8;
+
+private:
+  // Cheapest cost over to_store in [first_to_store, last_to_store] of every
+  // lane's previous cost (plus the constant cost when x > 0) and the
+  // production quantity reaching it, for one state.
+  using RelaxFunction = void (*)(const Cost *previous_costs, const int *demands, int state, int first_to_store,
+                                 int last_to_store, int production_capacity, Cost constant_cost, Cost *costs,
+                                 int *decisions);
+
+  static void relax_scalar(const Cost *previous_costs, const int *demands, int state, int first_to_store,
+                           int last_to_store, int production_capacity, Cost constant_cost, Cost *costs, int *decisions)
+  {
+    for (int lane = 0; lane < lanes; ++lane)
+    {
+      Cost optimal_cost = infeasible_cost;
+      int optimal_decision = no_decision;
+      for (int to_store = first_to_store; to_store <= last_to_store; ++to_store)
+      {
+        const int x = to_store - state + demands[lane];
+        const Cost previous_cost = previous_costs[to_store * lanes + lane];
+        if (x < 0 || x > production_capacity || previous_cost == infeasible_cost)
+          continue;
+
+        const Cost total_cost = previous_cost + (x > 0 ? constant_cost : 0);
+        if (optimal_cost > total_cost)
+        {
+          optimal_cost = total_cost;
+          optimal_decision = x;
+        }
+      }
+      costs[lane] = optimal_cost;
+      decisions[lane] = optimal_decision;
+    }
+  }
+
+#ifdef DP_ARGMIN_X86
+  // Sums with an infeasible previous cost wrap around, but are masked out
+  // before they are compared.
+  __attribute__((target("avx2"))) static void relax_avx2(const Cost *previous_costs, const int *demands, int state,
+                                                        int first_to_store, int last_to_store,
+                                                        int production_capacity, Cost constant_cost, Cost *costs,
+                                                        int *decisions)
+  {
+    const __m256i demand = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(demands));
+    const __m256i capacity_limit = _mm256_set1_epi32(production_capacity + 1);
+    const __m256i minus_one = _mm256_set1_epi32(-1);
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i infeasible = _mm256_set1_epi32(infeasible_cost);
+    const __m256i constant = _mm256_set1_epi32(constant_cost);
+
+    __m256i optimal_costs = infeasible;
+    __m256i optimal_decisions = minus_one;
+    for (int to_store = first_to_store; to_store <= last_to_store; ++to_store)
+    {
+      const __m256i x = _mm256_add_epi32(demand, _mm256_set1_epi32(to_store - state));
+      const __m256i previous = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(previous_costs + to_store * lanes));
+      __m256i valid = _mm256_and_si256(_mm256_cmpgt_epi32(x, minus_one), _mm256_cmpgt_epi32(capacity_limit, x));
+      valid = _mm256_andnot_si256(_mm256_cmpeq_epi32(previous, infeasible), valid);
+
+      const __m256i total = _mm256_add_epi32(previous, _mm256_and_si256(_mm256_cmpgt_epi32(x, zero), constant));
+      const __m256i improved = _mm256_and_si256(valid, _mm256_cmpgt_epi32(optimal_costs, total));
+      optimal_costs = _mm256_blendv_epi8(optimal_costs, total, improved);
+      optimal_decisions = _mm256_blendv_epi8(optimal_decisions, x, improved);
+    }
+
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(costs), optimal_costs);
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(decisions), optimal_decisions);
+  }
+#endif
+
+  static RelaxFunction select_relax(InstructionSet instruction_set)
+  {
+#ifdef DP_ARGMIN_X86
+    if (instruction_set == InstructionSet::avx2)
+      return relax_avx2;
+#endif
+    return relax_scalar;
+  }
+
+  std::size_t production_capacity = 0;
+  std::size_t store_capacity = 0;
+  std::size_t store_cost = 0;
+  std::size_t constant_production_cost = 0;
+  std::size_t good_production_cost = 0;
+  std::size_t stages_count = 0;
+  std::vector<std::vector<int>> requests;
+
+  RelaxFunction relax = select_relax(detect_instruction_set());
+  // Requests of one group of lanes, stage-major in reverse like
+  // DpProductionPlanner's stages; lanes past the last scenario repeat it.
+  std::vector<int> lane_requests;
+  // Two cost rows and every stage's decisions for one group of lanes.
+  std::vector<Cost> cost_rows;
+  std::vector<int> decision_rows;
+
+  std::vector<std::vector<int>> plan_decisions;
+  std::vector<std::size_t> plan_total_costs;
+  std::vector<char> plans_found;
+
+  Cost *cost_row(std::size_t stage)
+  {
+    return cost_rows.data() + (stage % 2) * (store_capacity + 1) * lanes;
+  }
+
+  int *decision_row(std::size_t stage)
+  {
+    return decision_rows.data() + stage * (store_capacity + 1) * lanes;
+  }
+
+  void calculate_group(std::size_t first_scenario)
+  {
+    const std::size_t scenarios_count = std::min<std::size_t>(lanes, requests.size() - first_scenario);
+    for (std::size_t stage = 0; stage < stages_count; ++stage)
+    {
+      for (int lane = 0; lane < lanes; ++lane)
+      {
+        const auto &scenario = requests[first_scenario + std::min<std::size_t>(lane, scenarios_count - 1)];
+        lane_requests[stage * lanes + lane] = scenario[stages_count - 1 - stage];
+      }
+    }
+
+    const int states_count = store_capacity + 1;
+    for (std::size_t stage = 0; stage < stages_count; ++stage)
+    {
+      const int *demands = lane_requests.data() + stage * lanes;
+      Cost *costs = cost_row(stage);
+      int *decisions = decision_row(stage);
+      std::fill(costs, costs + states_count * lanes, infeasible_cost);
+      std::fill(decisions, decisions + states_count * lanes, no_decision);
+      const int last_state = stage + 1 == stages_count ? 0 : store_capacity;
+
+      if (stage == 0)
+      {
+        for (int state = 0; state <= last_state; ++state)
+        {
+          for (int lane = 0; lane < lanes; ++lane)
+          {
+            const int x = demands[lane] - state;
+            if (x < 0 || x > int(production_capacity))
+              continue;
+
+            costs[state * lanes + lane] = (x > 0 ? constant_production_cost : 0) + store_cost * state;
+            decisions[state * lanes + lane] = x;
+          }
+        }
+        continue;
+      }
+
+      const Cost *previous_costs = cost_row(stage - 1);
+      const int min_demand = *std::min_element(demands, demands + lanes);
+      const int max_demand = *std::max_element(demands, demands + lanes);
+      for (int state = 0; state <= last_state; ++state)
+      {
+        const int first_to_store = std::max(state - max_demand, 0);
+        const int last_to_store = std::min<long long>((long long)state + production_capacity - min_demand, store_capacity);
+        if (first_to_store > last_to_store)
+          continue;
+
+        Cost *state_costs = costs + state * lanes;
+        relax(previous_costs, demands, state, first_to_store, last_to_store, production_capacity,
+              constant_production_cost, state_costs, decisions + state * lanes);
+        for (int lane = 0; lane < lanes; ++lane)
+        {
+          if (state_costs[lane] != infeasible_cost)
+            state_costs[lane] += store_cost * state;
+        }
+      }
+    }
+
+    for (std::size_t lane = 0; lane < scenarios_count; ++lane)
+      trace_lane(first_scenario + lane, lane);
+  }
+
+  void trace_lane(std::size_t scenario, std::size_t lane)
+  {
+    auto &decisions = plan_decisions[scenario];
+    decisions.clear();
+    plans_found[scenario] = false;
+    // An empty horizon has the empty plan, which costs nothing.
+    if (stages_count == 0)
+    {
+      plans_found[scenario] = true;
+      plan_total_costs[scenario] = 0;
+      return;
+    }
+
+    const Cost optimal_cost = cost_row(stages_count - 1)[lane];
+    if (optimal_cost == infeasible_cost)
+      return;
+
+    int state = 0;
+    for (std::size_t stage = stages_count; stage-- > 0;)
+    {
+      const int x = decision_row(stage)[state * lanes + lane];
+      decisions.push_back(x);
+      if (stage > 0)
+        state += x - lane_requests[stage * lanes + lane];
+    }
+
+    std::size_t goods_cost;
+    const std::size_t demand = std::accumulate(requests[scenario].begin(), requests[scenario].end(), std::size_t(0));
+    if (__builtin_mul_overflow(good_production_cost, demand, &goods_cost) ||
+        __builtin_add_overflow(goods_cost, std::size_t(optimal_cost), &plan_total_costs[scenario]))
+      throw std::overflow_error("Total cost overflow");
+    plans_found[scenario] = true;
+  }
+
+public:
+  // Prepares a batch; every scenario must have the same number of periods.
+  // Buffers of the previous batch are reused.
+  void reset(const std::size_t i_production_capacity,
+             const std::size_t i_store_capacity,
+             const std::size_t i_store_cost,
+             const std::size_t i_constant_production_cost,
+             const std::size_t i_good_production_cost,
+             const std::vector<std::vector<int>> &i_requests)
+  {
+    const CostType cost_type = select_cost_type(i_requests.empty() ? 0 : i_requests.front().size(), i_store_capacity,
+                                                i_store_cost, i_constant_production_cost);
+    if (cost_type != CostType::int16 && cost_type != CostType::int32)
+      throw std::overflow_error("Scenario costs do not fit 32-bit lanes");
+
+    production_capacity = i_production_capacity;
+    store_capacity = i_store_capacity;
+    store_cost = i_store_cost;
+    constant_production_cost = i_constant_production_cost;
+    good_production_cost = i_good_production_cost;
+    stages_count = i_requests.empty() ? 0 : i_requests.front().size();
+    if (std::any_of(i_requests.begin(), i_requests.end(), [this](const std::vector<int> &scenario)
+                    { return scenario.size() != stages_count; }))
+      throw std::invalid_argument("Scenarios of a batch must have the same number of periods");
+
+    requests.resize(i_requests.size());
+    for (std::size_t scenario = 0; scenario < i_requests.size(); ++scenario)
+      requests[scenario].assign(i_requests[scenario].begin(), i_requests[scenario].end());
+
+    lane_requests.resize(stages_count * lanes);
+    cost_rows.resize(2 * (store_capacity + 1) * lanes);
+    decision_rows.resize(stages_count * (store_capacity + 1) * lanes);
+    plan_decisions.resize(requests.size());
+    plan_total_costs.assign(requests.size(), 0);
+    plans_found.assign(requests.size(), false);
+  }
+
+  void calculate_stages()
+  {
+    for (std::size_t first_scenario = 0; first_scenario < requests.size(); first_scenario += lanes)
+      calculate_group(first_scenario);
+  }
+
+  std::size_t scenarios_count() const
+  {
+    return requests.size();
+  }
+
+  // Whether the scenario has a feasible plan.
+  bool found(std::size_t scenario) const
+  {
+    return plans_found[scenario];
+  }
+
+  // Production quantity of every period of the scenario's plan.
+  const std::vector<int> &decisions(std::size_t scenario) const
+  {
+    return plan_decisions[scenario];
+  }
+
+  std::size_t total_cost(std::size_t scenario) const
+  {
+    return plan_total_costs[scenario];
+  }
+};
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <limits>
+#include <utility>
+
+// Largest production and store capacity with a specialized solver.
+constexpr int max_small_capacity = 8;
+
+// Solves the instance with the backward recurrence of DpProductionPlanner's
+// stages and returns the optimal cost without the per-unit good cost, or the
+// largest Cost when there is no feasible plan. decision_rows receives the optimal
+// decision (or -1) of every state of every stage, stage-major with
+// store_capacity + 1 entries per stage; stage t is period
+// periods_count - 1 - t.
+template <typename Cost>
+using SmallCapacitySolver = Cost (*)(const int *requests, std::size_t periods_count, Cost store_cost,
+                                     Cost constant_cost, int *decision_rows);
+
+// With both capacities known at compile time the cost row is a std::array
+// kept in registers and the loops over states and production quantities
+// have constant trip counts, so the compiler unrolls them completely. Ties
+// go to the smallest production quantity, as in the stage tables.
+template <typename Cost, int ProductionCapacity, int StoreCapacity>
+Cost solve_small_capacities(const int *requests, std::size_t periods_count, Cost store_cost, Cost constant_cost,
+                            int *decision_rows)
+{
+  constexpr int states_count = StoreCapacity + 1;
+  constexpr Cost infeasible_cost = std::numeric_limits<Cost>::max();
+
+  std::array<Cost, states_count> costs;
+  int demand = requests[periods_count - 1];
+  for (int state = 0; state < states_count; ++state)
+  {
+    const int x = demand - state;
+    const bool feasible = x >= 0 && x <= ProductionCapacity;
+    costs[state] = feasible ? (x > 0 ? constant_cost : 0) + store_cost * state : infeasible_cost;
+    decision_rows[state] = feasible ? x : -1;
+  }
+
+  for (std::size_t stage = 1; stage < periods_count; ++stage)
+  {
+    demand = requests[periods_count - 1 - stage];
+    int *decision_row = decision_rows + stage * states_count;
+    std::array<Cost, states_count> next_costs;
+    for (int state = 0; state < states_count; ++state)
+    {
+      Cost optimal_cost = infeasible_cost;
+      int optimal_decision = -1;
+      for (int x = 0; x <= ProductionCapacity; ++x)
+      {
+        const int to_store = state + x - demand;
+        if (to_store < 0 || to_store > StoreCapacity || costs[to_store] == infeasible_cost)
+          continue;
+
+        const Cost total_cost = costs[to_store] + (x > 0 ? constant_cost : 0);
+        if (optimal_cost > total_cost)
+        {
+          optimal_cost = total_cost;
+          optimal_decision = x;
+        }
+      }
+      next_costs[state] = optimal_decision < 0 ? infeasible_cost : optimal_cost + store_cost * state;
+      decision_row[state] = optimal_decision;
+    }
+    costs = next_costs;
+  }
+
+  return costs[0];
+}
+
+template <typename Cost, int... Indices>
+constexpr std::array<SmallCapacitySolver<Cost>, sizeof...(Indices)> make_small_capacity_solvers(std::integer_sequence<int, Indices...>)
+{
+  return {{&solve_small_capacities<Cost, Indices / (max_small_capacity + 1), Indices % (max_small_capacity + 1)>...}};
+}
+
+// The solver specialized for the capacities, or nullptr when either is above
+// max_small_capacity.
+template <typename Cost>
+SmallCapacitySolver<Cost> select_small_capacity_solver(std::size_t production_capacity, std::size_t store_capacity)
+{
+  constexpr int capacities_count = max_small_capacity + 1;
+  static constexpr auto solvers = make_small_capacity_solvers<Cost>(std::make_integer_sequence<int, capacities_count * capacities_count>());
+
+  if (production_capacity > max_small_capacity || store_capacity > max_small_capacity)
+    return nullptr;
+  return solvers[production_capacity * capacities_count + store_capacity];
+}
@@ -0,0 +1,142 @@
+#pragma once
+
+#include <algorithm>
+#include <charconv>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+inline void print_table(const std::vector<std::vector<std::string>> &table)
+{
+  constexpr char boxing[] = "++|-+++++++";
+  constexpr std::size_t pad_size = 2;
+  std::vector<std::size_t> columns_width;
+  for (std::size_t col_index = 0; col_index < table[0].size(); ++col_index)
+  {
+    std::optional<std::size_t> max_width;
+    for (std::size_t row_index = 0; row_index < table.size(); ++row_index)
+    {
+      if (!max_width || max_width.value() < table[row_index][col_index].length() + pad_size)
+        max_width = table[row_index][col_index].length() + pad_size;
+    }
+
+    columns_width.emplace_back(max_width.value());
+  }
+
+  std::cout << boxing[8];
+  for (std::size_t col_index = 0; col_index < table[0].size(); ++col_index)
+  {
+    std::cout << std::string(columns_width[col_index], boxing[3]);
+    if (col_index < table[0].size() - 1)
+      std::cout << boxing[1];
+    else
+      std::cout << boxing[7] << std::endl;
+  }
+
+  for (std::size_t row_index = 0; row_index < table.size(); ++row_index)
+  {
+    std::cout << boxing[2];
+    for (std::size_t col_index = 0; col_index < table[0].size(); ++col_index)
+    {
+      std::cout << std::setw(columns_width[col_index]) << table[row_index][col_index];
+      std::cout << boxing[2];
+    }
+    std::cout << std::endl;
+
+    if (row_index == table.size() - 1)
+      continue;
+    std::cout << boxing[10];
+    for (std::size_t col_index = 0; col_index < table[0].size(); ++col_index)
+    {
+      std::cout << std::string(columns_width[col_index], boxing[3]);
+      if (col_index < table[0].size() - 1)
+        std::cout << boxing[4];
+      else
+        std::cout << boxing[9] << std::endl;
+    }
+  }
+  std::cout << boxing[5];
+  for (std::size_t col_index = 0; col_index < table[0].size(); ++col_index)
+  {
+    std::cout << std::string(columns_width[col_index], boxing[3]);
+    if (col_index < table[0].size() - 1)
+      std::cout << boxing[0];
+    else
+      std::cout << boxing[6] << std::endl;
+  }
+}
+
+// Draws the same tables as print_table into one buffer that is kept between
+// calls and written with a single unflushed write. Cells come from a callback
+// instead of a table of strings: cell(row, column, scratch) returns the text
+// of a cell as a string_view, either a literal or characters formatted into
+// scratch (see format). Cells are requested twice, once to measure the
+// columns and once to draw them.
+class TableRenderer
+{
+public:
+  static constexpr std::size_t max_cell_size = 32;
+  using CellBuffer = char[max_cell_size];
+
+  static std::string_view format(long long value, CellBuffer &scratch)
+  {
+    const auto result = std::to_chars(scratch, scratch + max_cell_size, value);
+    return std::string_view(scratch, result.ptr - scratch);
+  }
+
+  template <typename Cell>
+  void render(std::ostream &out, std::size_t rows_count, std::size_t columns_count, Cell &&cell)
+  {
+    constexpr char boxing[] = "++|-+++++++";
+    constexpr std::size_t pad_size = 2;
+
+    CellBuffer scratch;
+    columns_width.assign(columns_count, 0);
+    for (std::size_t row_index = 0; row_index < rows_count; ++row_index)
+    {
+      for (std::size_t col_index = 0; col_index < columns_count; ++col_index)
+        columns_width[col_index] = std::max(columns_width[col_index], cell(row_index, col_index, scratch).size() + pad_size);
+    }
+
+    buffer.clear();
+    append_rule(boxing[8], boxing[1], boxing[7]);
+    for (std::size_t row_index = 0; row_index < rows_count; ++row_index)
+    {
+      buffer += boxing[2];
+      for (std::size_t col_index = 0; col_index < columns_count; ++col_index)
+      {
+        const std::string_view text = cell(row_index, col_index, scratch);
+        buffer.append(columns_width[col_index] - text.size(), ' ');
+        buffer.append(text);
+        buffer += boxing[2];
+      }
+      buffer += '\n';
+
+      if (row_index < rows_count - 1)
+        append_rule(boxing[10], boxing[4], boxing[9]);
+    }
+    append_rule(boxing[5], boxing[0], boxing[6]);
+
+    out.write(buffer.data(), buffer.size());
+  }
+
+private:
+  void append_rule(char left, char middle, char right)
+  {
+    constexpr char horizontal = '-';
+
+    buffer += left;
+    for (std::size_t col_index = 0; col_index < columns_width.size(); ++col_index)
+    {
+      buffer.append(columns_width[col_index], horizontal);
+      buffer += col_index < columns_width.size() - 1 ? middle : right;
+    }
+    buffer += '\n';
+  }
+
+  std::string buffer;
+  std::vector<std::size_t> columns_width;
+};
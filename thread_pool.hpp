@@ -0,0 +1,166 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Runs the chunks of a loop on several workers and returns once all of them
+// are done, so each call is a barrier. Worker indices passed to the task are
+// below size().
+class ParallelFor
+{
+public:
+  // Called with the worker index and an inclusive range of the loop.
+  using Task = std::function<void(std::size_t, int, int)>;
+
+  virtual ~ParallelFor() = default;
+
+  virtual std::size_t size() const = 0;
+
+  // Runs task over [first, last] split into chunks of at least min_chunk_size.
+  // If chunks throw, the first exception is rethrown once all chunks are done.
+  virtual void parallel_for(int first, int last, int min_chunk_size, const Task &task) = 0;
+};
+
+// Persistent worker threads running one parallel_for at a time. The calling
+// thread works as worker 0.
+class ThreadPool : public ParallelFor
+{
+public:
+  // start_worker, if set, runs on every worker thread before the constructor
+  // returns, so per-thread setup never happens during a later parallel_for.
+  explicit ThreadPool(std::size_t threads_count, const std::function<void()> &start_worker = nullptr)
+  {
+    for (std::size_t worker = 1; worker < threads_count; ++worker)
+      workers.emplace_back([this, worker, &start_worker]
+                           {
+        if (start_worker)
+          start_worker();
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          ++started_workers;
+        }
+        work_done.notify_one();
+        work(worker); });
+
+    std::unique_lock<std::mutex> lock(mutex);
+    work_done.wait(lock, [this]
+                   { return started_workers == workers.size(); });
+  }
+
+  ~ThreadPool() override
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    work_available.notify_all();
+    for (auto &worker : workers)
+      worker.join();
+  }
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  std::size_t size() const override
+  {
+    return workers.size() + 1;
+  }
+
+  void parallel_for(int first, int last, int min_chunk_size, const Task &task) override
+  {
+    const int count = last - first + 1;
+    if (workers.empty() || count < 2 * min_chunk_size)
+    {
+      if (count > 0)
+        task(0, first, last);
+      return;
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      current_task = &task;
+      task_first = first;
+      task_last = last;
+      chunk_size = std::max(min_chunk_size, (count + 4 * int(size()) - 1) / (4 * int(size())));
+      next_chunk = 0;
+      busy_workers = workers.size();
+      ++generation;
+    }
+    work_available.notify_all();
+
+    run_chunks(0);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    work_done.wait(lock, [this]
+                   { return busy_workers == 0; });
+    if (task_exception)
+      std::rethrow_exception(std::exchange(task_exception, nullptr));
+  }
+
+private:
+  void run_chunks(std::size_t worker)
+  {
+    for (int chunk = next_chunk++;; chunk = next_chunk++)
+    {
+      const long long chunk_first = task_first + (long long)chunk * chunk_size;
+      if (chunk_first > task_last)
+        break;
+
+      try
+      {
+        (*current_task)(worker, chunk_first, std::min<long long>(chunk_first + chunk_size - 1, task_last));
+      }
+      catch (...)
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!task_exception)
+          task_exception = std::current_exception();
+      }
+    }
+  }
+
+  void work(std::size_t worker)
+  {
+    std::size_t seen_generation = 0;
+    while (true)
+    {
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        work_available.wait(lock, [&]
+                            { return stopping || generation != seen_generation; });
+        if (stopping)
+          return;
+        seen_generation = generation;
+      }
+
+      run_chunks(worker);
+
+      std::lock_guard<std::mutex> lock(mutex);
+      if (--busy_workers == 0)
+        work_done.notify_one();
+    }
+  }
+
+  std::vector<std::thread> workers;
+  std::mutex mutex;
+  std::condition_variable work_available;
+  std::condition_variable work_done;
+  bool stopping = false;
+  std::size_t generation = 0;
+  std::size_t busy_workers = 0;
+  std::size_t started_workers = 0;
+
+  const Task *current_task = nullptr;
+  int task_first = 0;
+  int task_last = 0;
+  int chunk_size = 1;
+  std::atomic<int> next_chunk{0};
+  std::exception_ptr task_exception;
+};
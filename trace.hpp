@@ -0,0 +1,193 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Timeline of solver phases written as Chrome trace-event JSON, which
+// chrome://tracing and Perfetto open. Each thread records complete spans
+// into its own ring buffer without locking; the buffers are written out once,
+// at exit, and a full buffer drops its oldest spans. While tracing is off a
+// span costs one atomic load.
+class Trace
+{
+public:
+  // One complete span. Names and argument names must be string literals, as
+  // only their pointers are kept.
+  struct Event
+  {
+    const char *name;
+    std::uint64_t start_ns;
+    std::uint64_t duration_ns;
+    const char *arg_names[2];
+    long long arg_values[2];
+  };
+
+  // Starts recording; the trace is written to path when the program exits.
+  // Threads are numbered in the order they record their first span.
+  static void start(const std::string &path, std::size_t events_per_thread = 1 << 20)
+  {
+    Trace &trace = instance();
+    trace.path = path;
+    trace.events_per_thread = events_per_thread;
+    trace.epoch = std::chrono::steady_clock::now();
+    std::atexit([]
+                { instance().write(); });
+    enabled_flag.store(true, std::memory_order_release);
+  }
+
+  static bool enabled()
+  {
+    return enabled_flag.load(std::memory_order_acquire);
+  }
+
+  static std::uint64_t now_ns()
+  {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - instance().epoch)
+        .count();
+  }
+
+  static void record(const Event &event)
+  {
+    ThreadBuffer *buffer = thread_buffer;
+    if (!buffer)
+      buffer = thread_buffer = instance().add_thread_buffer();
+
+    buffer->events[buffer->recorded % buffer->capacity] = event;
+    ++buffer->recorded;
+  }
+
+private:
+  struct ThreadBuffer
+  {
+    std::size_t thread_id = 0;
+    // Left uninitialized, so the pages of a large buffer are only committed
+    // as spans reach them.
+    std::unique_ptr<Event[]> events;
+    std::size_t capacity = 0;
+    // Spans recorded so far, including the overwritten ones.
+    std::size_t recorded = 0;
+  };
+
+  static Trace &instance()
+  {
+    static Trace trace;
+    return trace;
+  }
+
+  // Buffers are owned here rather than by their thread, so the spans of
+  // threads that have already exited are still written.
+  ThreadBuffer *add_thread_buffer()
+  {
+    auto buffer = std::make_unique<ThreadBuffer>();
+    buffer->events.reset(new Event[events_per_thread]);
+    buffer->capacity = events_per_thread;
+    const std::lock_guard<std::mutex> lock(buffers_mutex);
+    buffer->thread_id = buffers.size();
+    buffers.push_back(std::move(buffer));
+    return buffers.back().get();
+  }
+
+  // Trace event times are in microseconds.
+  static void write_microseconds(std::ostream &output, std::uint64_t nanoseconds)
+  {
+    output << nanoseconds / 1000 << '.' << std::setw(3) << std::setfill('0') << nanoseconds % 1000
+           << std::setfill(' ');
+  }
+
+  void write()
+  {
+    enabled_flag.store(false, std::memory_order_relaxed);
+    std::ofstream output(path);
+    if (!output)
+    {
+      std::cerr << "Cannot write trace " << path << std::endl;
+      return;
+    }
+
+    const std::lock_guard<std::mutex> lock(buffers_mutex);
+    std::size_t dropped = 0;
+    const char *separator = "";
+    output << "{\"traceEvents\": [";
+    for (const auto &buffer : buffers)
+    {
+      output << separator << "\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << buffer->thread_id
+             << ", \"args\": {\"name\": \"thread " << buffer->thread_id << "\"}}";
+      separator = ",";
+
+      const std::size_t capacity = buffer->capacity;
+      const std::size_t first = buffer->recorded > capacity ? buffer->recorded - capacity : 0;
+      dropped += first;
+      for (std::size_t index = first; index < buffer->recorded; ++index)
+      {
+        const Event &event = buffer->events[index % capacity];
+        output << ",\n{\"name\": \"" << event.name << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << buffer->thread_id
+               << ", \"ts\": ";
+        write_microseconds(output, event.start_ns);
+        output << ", \"dur\": ";
+        write_microseconds(output, event.duration_ns);
+        if (event.arg_names[0])
+        {
+          output << ", \"args\": {\"" << event.arg_names[0] << "\": " << event.arg_values[0];
+          if (event.arg_names[1])
+            output << ", \"" << event.arg_names[1] << "\": " << event.arg_values[1];
+          output << "}";
+        }
+        output << "}";
+      }
+    }
+    output << "\n], \"displayTimeUnit\": \"ns\", \"otherData\": {\"dropped_events\": " << dropped << "}}\n";
+  }
+
+  inline static std::atomic<bool> enabled_flag{false};
+  inline static thread_local ThreadBuffer *thread_buffer = nullptr;
+
+  std::string path;
+  std::size_t events_per_thread = 0;
+  std::chrono::steady_clock::time_point epoch;
+  std::mutex buffers_mutex;
+  std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+};
+
+// Records the time from its construction to its destruction as a span of the
+// current thread, with up to two integer arguments.
+class TraceSpan
+{
+public:
+  explicit TraceSpan(const char *name, const char *arg_name = nullptr, long long arg_value = 0,
+                     const char *second_arg_name = nullptr, long long second_arg_value = 0)
+  {
+    if (!Trace::enabled())
+      return;
+
+    event.name = name;
+    event.arg_names[0] = arg_name;
+    event.arg_names[1] = second_arg_name;
+    event.arg_values[0] = arg_value;
+    event.arg_values[1] = second_arg_value;
+    event.start_ns = Trace::now_ns();
+  }
+
+  TraceSpan(const TraceSpan &) = delete;
+  TraceSpan &operator=(const TraceSpan &) = delete;
+
+  ~TraceSpan()
+  {
+    if (!event.name)
+      return;
+
+    event.duration_ns = Trace::now_ns() - event.start_ns;
+    Trace::record(event);
+  }
+
+private:
+  Trace::Event event = {};
+};
@@ -0,0 +1,320 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "thread_pool.hpp"
+
+// Runs a batch of independent jobs on persistent workers. Each worker takes
+// jobs from the back of its own queue and, once that is empty, steals from
+// the front of the others', so a few large jobs do not leave the rest of the
+// workers idle behind them. A job can split a loop through its worker's
+// parallel_for: the chunks go to a second queue of that worker, which idle
+// workers steal from before they take another job, so a huge instance late
+// in a batch still spreads across every core. The calling thread works as
+// worker 0 during run.
+class WorkStealingExecutor
+{
+public:
+  // Called with the index of the worker running the job.
+  using Job = std::function<void(std::size_t)>;
+
+  explicit WorkStealingExecutor(std::size_t threads_count)
+  {
+    threads_count = std::max<std::size_t>(threads_count, 1);
+    for (std::size_t worker = 0; worker < threads_count; ++worker)
+      queues.push_back(std::make_unique<WorkerQueue>(*this, worker));
+    for (std::size_t worker = 1; worker < threads_count; ++worker)
+      workers.emplace_back([this, worker]
+                           { work(worker); });
+  }
+
+  ~WorkStealingExecutor()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    work_available.notify_all();
+    for (auto &worker : workers)
+      worker.join();
+  }
+
+  WorkStealingExecutor(const WorkStealingExecutor &) = delete;
+  WorkStealingExecutor &operator=(const WorkStealingExecutor &) = delete;
+
+  std::size_t size() const
+  {
+    return queues.size();
+  }
+
+  // The parallel_for of jobs running on worker.
+  ParallelFor &worker_parallel_for(std::size_t worker)
+  {
+    return *queues[worker];
+  }
+
+  // Runs every job and returns once all of them are done. Jobs are dealt out
+  // round robin to the front of the queues, so each worker runs its own jobs
+  // in the order they were dealt and thieves take the last dealt ones.
+  void run(std::vector<Job> &jobs)
+  {
+    if (jobs.empty())
+      return;
+
+    const std::size_t jobs_count = jobs.size();
+    for (std::size_t job = 0; job < jobs_count; ++job)
+    {
+      WorkerQueue &queue = *queues[job % queues.size()];
+      std::lock_guard<std::mutex> lock(queue.mutex);
+      queue.jobs.push_front(std::move(jobs[job]));
+    }
+    jobs.clear();
+
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      unfinished_jobs = jobs_count;
+      busy_workers = workers.size();
+      ++generation;
+    }
+    work_available.notify_all();
+
+    run_jobs(0);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    work_done.wait(lock, [this]
+                   { return busy_workers == 0; });
+  }
+
+private:
+  // The chunks of one parallel_for call still queued or running elsewhere,
+  // and the first exception any of them threw.
+  struct ChunkGroup
+  {
+    std::atomic<int> unfinished_chunks{0};
+    std::mutex mutex;
+    std::exception_ptr exception;
+
+    void fail(std::exception_ptr chunk_exception)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (!exception)
+        exception = chunk_exception;
+    }
+  };
+
+  struct Chunk
+  {
+    const ParallelFor::Task *task = nullptr;
+    int first = 0;
+    int last = 0;
+    ChunkGroup *group = nullptr;
+  };
+
+  struct WorkerQueue : ParallelFor
+  {
+    WorkerQueue(WorkStealingExecutor &executor, std::size_t worker) : executor(executor), worker(worker)
+    {
+    }
+
+    std::size_t size() const override
+    {
+      return executor.size();
+    }
+
+    // Queues every chunk but the first, runs the first and then whatever is
+    // left of its own chunks, helping with other workers' chunks while the
+    // stolen ones finish.
+    void parallel_for(int first, int last, int min_chunk_size, const Task &task) override
+    {
+      const int count = last - first + 1;
+      if (executor.size() == 1 || count < 2 * min_chunk_size)
+      {
+        if (count > 0)
+          task(worker, first, last);
+        return;
+      }
+
+      const int chunk_size = std::max(min_chunk_size, (count + 4 * int(size()) - 1) / (4 * int(size())));
+      const int chunks_count = (count + chunk_size - 1) / chunk_size;
+      ChunkGroup group;
+      group.unfinished_chunks = chunks_count - 1;
+      executor.pending_chunks += chunks_count - 1;
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (int chunk = chunks_count - 1; chunk > 0; --chunk)
+        {
+          const int chunk_first = first + chunk * chunk_size;
+          chunks.push_back({&task, chunk_first, std::min(chunk_first + chunk_size - 1, last), &group});
+        }
+      }
+
+      try
+      {
+        task(worker, first, std::min(first + chunk_size - 1, last));
+      }
+      catch (...)
+      {
+        group.fail(std::current_exception());
+      }
+      while (group.unfinished_chunks.load() > 0)
+      {
+        if (!executor.run_chunk(worker))
+          std::this_thread::yield();
+      }
+      if (group.exception)
+        std::rethrow_exception(group.exception);
+    }
+
+    WorkStealingExecutor &executor;
+    const std::size_t worker;
+    std::mutex mutex;
+    std::deque<Job> jobs;
+    std::deque<Chunk> chunks;
+  };
+
+  // Runs one chunk, the worker's own newest first (the lowest range left of
+  // its latest loop), otherwise the oldest of another worker; returns false
+  // when there was none.
+  bool run_chunk(std::size_t worker)
+  {
+    if (pending_chunks.load() == 0)
+      return false;
+
+    Chunk chunk;
+    bool found = false;
+    for (std::size_t offset = 0; offset < queues.size() && !found; ++offset)
+    {
+      WorkerQueue &queue = *queues[(worker + offset) % queues.size()];
+      std::lock_guard<std::mutex> lock(queue.mutex);
+      if (queue.chunks.empty())
+        continue;
+
+      if (offset == 0)
+      {
+        chunk = queue.chunks.back();
+        queue.chunks.pop_back();
+      }
+      else
+      {
+        chunk = queue.chunks.front();
+        queue.chunks.pop_front();
+      }
+      found = true;
+    }
+    if (!found)
+      return false;
+
+    --pending_chunks;
+    try
+    {
+      (*chunk.task)(worker, chunk.first, chunk.last);
+    }
+    catch (...)
+    {
+      chunk.group->fail(std::current_exception());
+    }
+    --chunk.group->unfinished_chunks;
+    return true;
+  }
+
+  // Takes the worker's oldest job, the first dealt to it, otherwise the
+  // newest of another worker.
+  bool take_job(std::size_t worker, Job &job)
+  {
+    for (std::size_t offset = 0; offset < queues.size(); ++offset)
+    {
+      WorkerQueue &queue = *queues[(worker + offset) % queues.size()];
+      std::lock_guard<std::mutex> lock(queue.mutex);
+      if (queue.jobs.empty())
+        continue;
+
+      if (offset == 0)
+      {
+        job = std::move(queue.jobs.back());
+        queue.jobs.pop_back();
+      }
+      else
+      {
+        job = std::move(queue.jobs.front());
+        queue.jobs.pop_front();
+      }
+      return true;
+    }
+    return false;
+  }
+
+  // Once there is nothing left to take, the worker keeps polling for chunks
+  // of the jobs still running, backing off to short sleeps so it does not
+  // compete with them for the core when threads outnumber cores.
+  void run_jobs(std::size_t worker)
+  {
+    constexpr int idle_yields = 64;
+
+    Job job;
+    int idle_polls = 0;
+    while (unfinished_jobs.load() > 0)
+    {
+      if (run_chunk(worker))
+      {
+        idle_polls = 0;
+        continue;
+      }
+
+      if (take_job(worker, job))
+      {
+        job(worker);
+        job = nullptr;
+        --unfinished_jobs;
+        idle_polls = 0;
+      }
+      else if (++idle_polls < idle_yields)
+        std::this_thread::yield();
+      else
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+  }
+
+  void work(std::size_t worker)
+  {
+    std::size_t seen_generation = 0;
+    while (true)
+    {
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        work_available.wait(lock, [&]
+                            { return stopping || generation != seen_generation; });
+        if (stopping)
+          return;
+        seen_generation = generation;
+      }
+
+      run_jobs(worker);
+
+      std::lock_guard<std::mutex> lock(mutex);
+      if (--busy_workers == 0)
+        work_done.notify_one();
+    }
+  }
+
+  std::vector<std::unique_ptr<WorkerQueue>> queues;
+  std::vector<std::thread> workers;
+  std::mutex mutex;
+  std::condition_variable work_available;
+  std::condition_variable work_done;
+  bool stopping = false;
+  std::size_t generation = 0;
+  std::size_t busy_workers = 0;
+
+  std::atomic<std::size_t> unfinished_jobs{0};
+  std::atomic<int> pending_chunks{0};
+};